@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -31,6 +32,8 @@ static double first_time, last_time;
 
 /* Implement buffered I/O using variant of RIO package from CS:APP
  * Must create stack of buffers to handle I/O with nested source commands.
+ * Regular files are mapped whole instead, and their lines are found with
+ * memchr() rather than read through buf one character at a time.
  */
 
 #define RIO_BUFSIZE 8192
@@ -40,12 +43,18 @@ typedef struct __rio {
     int count;             /* Unread bytes in internal buffer */
     char *bufptr;          /* Next unread byte in internal buffer */
     char buf[RIO_BUFSIZE]; /* Internal buffer */
+    char *map;             /* Mapped file, or NULL when read through buf */
+    size_t map_len;        /* Size of the mapping */
     struct __rio *prev;    /* Next element in stack */
 } rio_t;
 
 static rio_t *buf_stack;
 static char linebuf[RIO_BUFSIZE];
 
+/* Argument array reused by every command read with readline() */
+static char **line_argv = NULL;
+static int line_argv_cap = 0;
+
 /* Maximum file descriptor */
 static int fd_max = 0;
 
@@ -54,6 +63,9 @@ static int err_limit = 5;
 static int err_cnt = 0;
 static int echo = 0;
 
+/* Whether reports are written by a background thread */
+static int async_log = 0;
+
 static bool quit_flag = false;
 static char *prompt = "cmd> ";
 static bool has_infile = false;
@@ -65,6 +77,9 @@ static bool has_infile = false;
 static cmd_func_t quit_helpers[MAXQUIT];
 static int quit_helper_cnt = 0;
 
+/* Optional functions to call around every command */
+static cmd_hook_t cmd_before = NULL, cmd_after = NULL;
+
 static void init_in();
 
 static bool push_file(char *fname);
@@ -178,7 +193,11 @@ static bool interpret_cmda(int argc, char *argv[])
     while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
         next_cmd = next_cmd->next;
     if (next_cmd) {
+        if (cmd_before)
+            cmd_before(argc, argv);
         ok = next_cmd->operation(argc, argv);
+        if (cmd_after)
+            cmd_after(argc, argv);
         if (!ok)
             record_error();
     } else {
@@ -206,6 +225,48 @@ static bool interpret_cmd(char *cmdline)
     return ok;
 }
 
+/* Execute a command line read with readline().  The line is split into
+ * arguments in place, so no memory is allocated for it once line_argv is
+ * large enough.
+ */
+static bool interpret_line(char *line)
+{
+    if (quit_flag)
+        return false;
+
+    int argc = 0;
+    char *p = line;
+    for (;;) {
+        while (isspace(*p))
+            p++;
+        if (!*p)
+            break;
+        if (argc == line_argv_cap) {
+            int cap = line_argv_cap ? 2 * line_argv_cap : 16;
+            char **argv = malloc_or_fail(cap * sizeof(char *), "interpret_line");
+            if (line_argv) {
+                memcpy(argv, line_argv, argc * sizeof(char *));
+                free_block(line_argv, line_argv_cap * sizeof(char *));
+            }
+            line_argv = argv;
+            line_argv_cap = cap;
+        }
+        line_argv[argc++] = p;
+        while (*p && !isspace(*p))
+            p++;
+        if (*p)
+            *p++ = '\0';
+    }
+    return interpret_cmda(argc, line_argv);
+}
+
+/* Set functions to be executed around every command */
+void set_cmd_hooks(cmd_hook_t before, cmd_hook_t after)
+{
+    cmd_before = before;
+    cmd_after = after;
+}
+
 /* Set function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf)
 {
@@ -392,7 +453,7 @@ static bool do_time(int argc, char *argv[])
 }
 
 static bool use_linenoise = true;
-static int web_fd;
+static int web_fd = -1;
 
 static bool do_web(int argc, char *argv[])
 {
@@ -413,6 +474,14 @@ static bool do_web(int argc, char *argv[])
     return true;
 }
 
+static void async_log_set(int oldval)
+{
+    if (!set_log_async(async_log)) {
+        report(1, "Could not start the log writer thread");
+        async_log = 0;
+    }
+}
+
 /* Initialize interpreter */
 void init_cmd()
 {
@@ -436,6 +505,9 @@ void init_cmd()
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
     add_param("entropy", &show_entropy, "Show/Hide Shannon entropy", NULL);
+    add_param("asynclog", &async_log,
+              "Write reports from a background thread, flushed before prompts",
+              async_log_set);
 
     init_in();
     init_time(&last_time);
@@ -460,6 +532,20 @@ static bool push_file(char *fname)
     rnew->fd = fd;
     rnew->count = 0;
     rnew->bufptr = rnew->buf;
+    rnew->map = NULL;
+    rnew->map_len = 0;
+
+    /* Map trace files instead of copying them in through buf */
+    struct stat st;
+    if (fname && !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            rnew->map = map;
+            rnew->map_len = st.st_size;
+            rnew->bufptr = map;
+        }
+    }
     rnew->prev = buf_stack;
     buf_stack = rnew;
 
@@ -472,6 +558,8 @@ static void pop_file()
     if (buf_stack) {
         rio_t *rsave = buf_stack;
         buf_stack = rsave->prev;
+        if (rsave->map)
+            munmap(rsave->map, rsave->map_len);
         close(rsave->fd);
         free_block(rsave, sizeof(rio_t));
     }
@@ -483,6 +571,45 @@ static void init_in()
     buf_stack = NULL;
 }
 
+/* Copy the next line of the mapped file on top of the stack into linebuf,
+ * with the same limits as readline() applies to files read through buf.
+ */
+static char *readline_mapped()
+{
+    rio_t *rp = buf_stack;
+    char *end = rp->map + rp->map_len;
+
+    if (rp->bufptr >= end) {
+        /* Encountered EOF */
+        pop_file();
+        return NULL;
+    }
+
+    size_t len = end - rp->bufptr;
+    if (len > RIO_BUFSIZE - 2)
+        len = RIO_BUFSIZE - 2;
+    char *nl = memchr(rp->bufptr, '\n', len);
+    if (nl)
+        len = nl - rp->bufptr + 1;
+    memcpy(linebuf, rp->bufptr, len);
+    rp->bufptr += len;
+
+    if (!nl) {
+        /* Last line of file did not terminate with newline, or hit buffer
+         * limit.  Artificially terminate line
+         */
+        linebuf[len++] = '\n';
+    }
+    linebuf[len] = '\0';
+
+    if (echo) {
+        report_noreturn(1, prompt);
+        report_noreturn(1, linebuf);
+    }
+
+    return linebuf;
+}
+
 /* Read command from input file.
  * When hit EOF, close that file and return NULL
  */
@@ -493,6 +620,8 @@ static char *readline()
 
     if (!buf_stack)
         return NULL;
+    if (buf_stack->map)
+        return readline_mapped();
 
     for (int cnt = 0; cnt < RIO_BUFSIZE - 2; cnt++) {
         if (buf_stack->count <= 0) {
@@ -554,6 +683,17 @@ static bool cmd_done()
  * If nfds == 0, this indicates that there is no pending network activity
  */
 int web_connfd;
+
+/* Run a command received over the web, with its output going back there */
+static bool web_cmd(int fd, char *cmdline)
+{
+    web_connfd = fd;
+    bool ok = interpret_cmd(cmdline);
+    report_flush();
+    web_connfd = 0;
+    return ok;
+}
+
 static int cmd_select(int nfds,
                       fd_set *readfds,
                       fd_set *writefds,
@@ -566,6 +706,17 @@ static int cmd_select(int nfds,
     if (cmd_done())
         return 0;
 
+    /* A mapped file is always readable, so only wait in select() when there
+     * are other descriptors to watch as well
+     */
+    if (!block_flag && !readfds && !nfds && web_fd == -1 && buf_stack->map) {
+        set_echo(0);
+        char *cmdline = readline();
+        if (cmdline)
+            interpret_line(cmdline);
+        return 1;
+    }
+
     if (!block_flag) {
         /* Process any commands in input buffer */
         if (!readfds)
@@ -578,9 +729,10 @@ static int cmd_select(int nfds,
 
         /* If web not ready listen */
         if (web_fd != -1)
-            FD_SET(web_fd, readfds);
+            FD_SET(web_eventfd(), readfds);
 
         if (infd == STDIN_FILENO && prompt_flag) {
+            report_flush();
             printf("%s", prompt);
             fflush(stdout);
             prompt_flag = true;
@@ -588,8 +740,8 @@ static int cmd_select(int nfds,
 
         if (infd >= nfds)
             nfds = infd + 1;
-        if (web_fd >= nfds)
-            nfds = web_fd + 1;
+        if (web_fd != -1 && web_eventfd() >= nfds)
+            nfds = web_eventfd() + 1;
     }
     if (nfds == 0)
         return 0;
@@ -607,23 +759,11 @@ static int cmd_select(int nfds,
         set_echo(0);
         char *cmdline = readline();
         if (cmdline)
-            interpret_cmd(cmdline);
-    } else if (readfds && FD_ISSET(web_fd, readfds)) {
-        FD_CLR(web_fd, readfds);
+            interpret_line(cmdline);
+    } else if (readfds && web_fd != -1 && FD_ISSET(web_eventfd(), readfds)) {
+        FD_CLR(web_eventfd(), readfds);
         result--;
-        struct sockaddr_in clientaddr;
-        socklen_t clientlen = sizeof(clientaddr);
-        web_connfd =
-            accept(web_fd, (struct sockaddr *) &clientaddr, &clientlen);
-
-        char *p = web_recv(web_connfd, &clientaddr);
-        char *buffer = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
-        web_send(web_connfd, buffer);
-
-        if (p)
-            interpret_cmd(p);
-        free(p);
-        close(web_connfd);
+        web_dispatch(web_cmd);
     }
     return result;
 }
@@ -633,7 +773,16 @@ bool finish_cmd()
     bool ok = true;
     if (!quit_flag)
         ok = ok && do_quit(0, NULL);
+
+    /* Not in do_quit(): its argv, and that of the hook run after it, may be
+     * line_argv itself
+     */
+    if (line_argv)
+        free_block(line_argv, line_argv_cap * sizeof(char *));
+    line_argv = NULL;
+    line_argv_cap = 0;
     has_infile = false;
+    report_flush();
     return ok && err_cnt == 0;
 }
 
@@ -56,6 +56,12 @@ bool get_int(char *vname, int *loc);
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
+/* Functions called right before and right after every command */
+typedef void (*cmd_hook_t)(int argc, char *argv[]);
+
+/* Set the functions called around every command, NULL for none */
+void set_cmd_hooks(cmd_hook_t before, cmd_hook_t after);
+
 /* Turn echoing on/off */
 void set_echo(bool on);
 
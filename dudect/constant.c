@@ -6,6 +6,7 @@
 #include "cpucycles.h"
 #include "queue.h"
 #include "random.h"
+#include "unrolled.h"
 
 /* Maintain a queue independent from the qtest since
  * we do not want the test to affect the original functionality
@@ -36,6 +37,62 @@ static struct list_head *l = NULL;
 
 #define dut_free() ((void) (q_free(l)))
 
+/* Insert an element at one end and take it out again, untimed, so that the
+ * insertion timed next finds the allocator, the harness and that end of the
+ * queue as warm for an empty queue as for a long one.  For the same reason,
+ * queues are filled from the end that the timed operation works on.
+ */
+#define dut_rehearse(end, s)                         \
+    do {                                             \
+        q_insert_##end(l, s);                        \
+        element_t *__e = q_remove_##end(l, NULL, 0); \
+        if (__e)                                     \
+            q_release_element(__e);                  \
+    } while (0)
+
+/* The concurrent queue measured on its own, from a single thread */
+static mpmc_t *mq = NULL;
+
+#define dut_mpmc_new() ((void) (mq = q_mpmc_new(MPMC_MEASURE_CAPACITY)))
+
+#define dut_mpmc_insert_tail(s, n)     \
+    do {                               \
+        int j = n;                     \
+        while (j--)                    \
+            q_mpmc_insert_tail(mq, s); \
+    } while (0)
+
+#define dut_mpmc_free() ((void) (q_mpmc_free(mq)))
+
+/* The unrolled queue, measured like the list queue */
+static uq_t *uq = NULL;
+
+#define dut_uq_new() ((void) (uq = uq_new()))
+
+#define dut_uq_insert_head(s, n)   \
+    do {                           \
+        int j = n;                 \
+        while (j--)                \
+            uq_insert_head(uq, s); \
+    } while (0)
+
+#define dut_uq_insert_tail(s, n)   \
+    do {                           \
+        int j = n;                 \
+        while (j--)                \
+            uq_insert_tail(uq, s); \
+    } while (0)
+
+#define dut_uq_free() ((void) (uq_free(uq)))
+
+#define dut_uq_rehearse(end, s)                        \
+    do {                                               \
+        uq_insert_##end(uq, s);                        \
+        element_t *__e = uq_remove_##end(uq, NULL, 0); \
+        if (__e)                                       \
+            q_release_element(__e);                    \
+    } while (0)
+
 static char random_string[N_MEASURES][8];
 static int random_string_iter = 0;
 
@@ -43,6 +100,8 @@ static int random_string_iter = 0;
 void init_dut(void)
 {
     l = NULL;
+    mq = NULL;
+    uq = NULL;
 }
 
 static char *get_random_string(void)
@@ -72,10 +131,28 @@ bool measure(int64_t *before_ticks,
              uint8_t *input_data,
              int mode)
 {
-    assert(mode == DUT(insert_head) || mode == DUT(insert_tail) ||
-           mode == DUT(remove_head) || mode == DUT(remove_tail));
+    assert(mode == DUT(size) || mode == DUT(insert_head) ||
+           mode == DUT(insert_tail) || mode == DUT(remove_head) ||
+           mode == DUT(remove_tail) || mode == DUT(mpmc_insert_tail) ||
+           mode == DUT(mpmc_remove_head) ||
+           mode == DUT(uq_insert_head) || mode == DUT(uq_insert_tail) ||
+           mode == DUT(uq_remove_head) || mode == DUT(uq_remove_tail));
 
     switch (mode) {
+    case DUT(size):
+        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+            int n = *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000;
+            dut_new();
+            dut_insert_head(get_random_string(), n);
+            before_ticks[i] = cpucycles_begin();
+            dut_size(1);
+            after_ticks[i] = cpucycles_end();
+            int size = q_size(l);
+            dut_free();
+            if (size != n)
+                return false;
+        }
+        break;
     case DUT(insert_head):
         for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
             char *s = get_random_string();
@@ -83,10 +160,11 @@ bool measure(int64_t *before_ticks,
             dut_insert_head(
                 get_random_string(),
                 *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
+            dut_rehearse(head, s);
             int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            before_ticks[i] = cpucycles_begin();
             dut_insert_head(s, 1);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end();
             int after_size = q_size(l);
             dut_free();
             if (before_size != after_size - 1)
@@ -97,13 +175,14 @@ bool measure(int64_t *before_ticks,
         for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
             char *s = get_random_string();
             dut_new();
-            dut_insert_head(
+            dut_insert_tail(
                 get_random_string(),
                 *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
+            dut_rehearse(tail, s);
             int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            before_ticks[i] = cpucycles_begin();
             dut_insert_tail(s, 1);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end();
             int after_size = q_size(l);
             dut_free();
             if (before_size != after_size - 1)
@@ -117,9 +196,9 @@ bool measure(int64_t *before_ticks,
                 get_random_string(),
                 *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
             int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            before_ticks[i] = cpucycles_begin();
             element_t *e = q_remove_head(l, NULL, 0);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end();
             int after_size = q_size(l);
             if (e)
                 q_release_element(e);
@@ -131,13 +210,13 @@ bool measure(int64_t *before_ticks,
     case DUT(remove_tail):
         for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
             dut_new();
-            dut_insert_head(
+            dut_insert_tail(
                 get_random_string(),
                 *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
             int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
+            before_ticks[i] = cpucycles_begin();
             element_t *e = q_remove_tail(l, NULL, 0);
-            after_ticks[i] = cpucycles();
+            after_ticks[i] = cpucycles_end();
             int after_size = q_size(l);
             if (e)
                 q_release_element(e);
@@ -146,17 +225,221 @@ bool measure(int64_t *before_ticks,
                 return false;
         }
         break;
-    default:
+    case DUT(mpmc_insert_tail):
         for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
+            char *s = get_random_string();
+            dut_mpmc_new();
+            if (!mq)
+                return false;
+            dut_mpmc_insert_tail(
                 get_random_string(),
                 *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_size(1);
-            after_ticks[i] = cpucycles();
-            dut_free();
+            size_t before_size = q_mpmc_size(mq);
+            before_ticks[i] = cpucycles_begin();
+            dut_mpmc_insert_tail(s, 1);
+            after_ticks[i] = cpucycles_end();
+            size_t after_size = q_mpmc_size(mq);
+            dut_mpmc_free();
+            if (before_size != after_size - 1)
+                return false;
         }
+        break;
+    case DUT(mpmc_remove_head):
+        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+            dut_mpmc_new();
+            if (!mq)
+                return false;
+            dut_mpmc_insert_tail(
+                get_random_string(),
+                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
+            size_t before_size = q_mpmc_size(mq);
+            before_ticks[i] = cpucycles_begin();
+            element_t *e = q_mpmc_remove_head(mq, NULL, 0);
+            after_ticks[i] = cpucycles_end();
+            size_t after_size = q_mpmc_size(mq);
+            if (e)
+                q_release_element(e);
+            dut_mpmc_free();
+            if (before_size != after_size + 1)
+                return false;
+        }
+        break;
+    case DUT(uq_insert_head):
+        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+            char *s = get_random_string();
+            dut_uq_new();
+            if (!uq)
+                return false;
+            dut_uq_insert_head(
+                get_random_string(),
+                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
+            dut_uq_rehearse(head, s);
+            int before_size = uq_size(uq);
+            before_ticks[i] = cpucycles_begin();
+            dut_uq_insert_head(s, 1);
+            after_ticks[i] = cpucycles_end();
+            int after_size = uq_size(uq);
+            dut_uq_free();
+            if (before_size != after_size - 1)
+                return false;
+        }
+        break;
+    case DUT(uq_insert_tail):
+        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+            char *s = get_random_string();
+            dut_uq_new();
+            if (!uq)
+                return false;
+            dut_uq_insert_tail(
+                get_random_string(),
+                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
+            dut_uq_rehearse(tail, s);
+            int before_size = uq_size(uq);
+            before_ticks[i] = cpucycles_begin();
+            dut_uq_insert_tail(s, 1);
+            after_ticks[i] = cpucycles_end();
+            int after_size = uq_size(uq);
+            dut_uq_free();
+            if (before_size != after_size - 1)
+                return false;
+        }
+        break;
+    case DUT(uq_remove_head):
+        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+            dut_uq_new();
+            if (!uq)
+                return false;
+            dut_uq_insert_head(
+                get_random_string(),
+                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
+            int before_size = uq_size(uq);
+            before_ticks[i] = cpucycles_begin();
+            element_t *e = uq_remove_head(uq, NULL, 0);
+            after_ticks[i] = cpucycles_end();
+            int after_size = uq_size(uq);
+            if (e)
+                q_release_element(e);
+            dut_uq_free();
+            if (before_size != after_size + 1)
+                return false;
+        }
+        break;
+    case DUT(uq_remove_tail):
+        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+            dut_uq_new();
+            if (!uq)
+                return false;
+            dut_uq_insert_tail(
+                get_random_string(),
+                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
+            int before_size = uq_size(uq);
+            before_ticks[i] = cpucycles_begin();
+            element_t *e = uq_remove_tail(uq, NULL, 0);
+            after_ticks[i] = cpucycles_end();
+            int after_size = uq_size(uq);
+            if (e)
+                q_release_element(e);
+            dut_uq_free();
+            if (before_size != after_size + 1)
+                return false;
+        }
+        break;
     }
     return true;
 }
+
+/* Fill the queue at @q with @n fresh random strings */
+static void fill_random(struct list_head *q, int n)
+{
+    char s[8];
+    for (int i = 0; i < n; i++) {
+        randombytes((uint8_t *) s, 7);
+        s[7] = 0;
+        q_insert_tail(q, s);
+    }
+}
+
+/* Time a plain walk over the queue at @head, storing its length into @len.
+ * The first walk only brings the elements into the cache, so that the one
+ * timed finds them as warm as the operation measured after it does.
+ */
+static int64_t time_walk(struct list_head *head, int *len)
+{
+    struct list_head *node;
+    int cnt = 0;
+
+    list_for_each (node, head)
+        cnt--;
+    int64_t before = cpucycles_begin();
+    list_for_each (node, head)
+        cnt += 2;
+    int64_t after = cpucycles_end();
+    *len = cnt;
+    return after - before;
+}
+
+/* Time one call of a scaling operation on queues holding @n elements in
+ * total, with random strings.  @walk_ticks gets the time of walking the
+ * same elements right before, which the caller can use to factor out the
+ * cost of memory accesses.
+ */
+bool measure_scaling(int64_t *ticks, int64_t *walk_ticks, int n, int mode)
+{
+    assert(mode == DUT(delete_mid) || mode == DUT(reverse) ||
+           mode == DUT(sort) || mode == DUT(merge));
+
+    int64_t before, after;
+    int len;
+    bool ok = true;
+
+    if (mode == DUT(merge)) {
+        queue_contex_t ctx[MERGE_QUEUES];
+        LIST_HEAD(chain);
+        *walk_ticks = 0;
+        for (int i = 0; i < MERGE_QUEUES; i++) {
+            ctx[i].q = q_new();
+            ctx[i].size = n / MERGE_QUEUES;
+            ctx[i].id = i;
+            fill_random(ctx[i].q, ctx[i].size);
+            q_sort(ctx[i].q);
+            list_add_tail(&ctx[i].chain, &chain);
+        }
+        for (int i = 0; i < MERGE_QUEUES; i++) {
+            *walk_ticks += time_walk(ctx[i].q, &len);
+            ok &= len == ctx[i].size;
+        }
+        before = cpucycles_begin();
+        len = q_merge(&chain);
+        after = cpucycles_end();
+        ok &= len == MERGE_QUEUES * (n / MERGE_QUEUES);
+        for (int i = 0; i < MERGE_QUEUES; i++)
+            q_free(ctx[i].q);
+        *ticks = after - before;
+        return ok;
+    }
+
+    dut_new();
+    fill_random(l, n);
+    *walk_ticks = time_walk(l, &len);
+    ok = len == n;
+    switch (mode) {
+    case DUT(delete_mid):
+        before = cpucycles_begin();
+        ok &= q_delete_mid(l);
+        after = cpucycles_end();
+        break;
+    case DUT(reverse):
+        before = cpucycles_begin();
+        q_reverse(l);
+        after = cpucycles_end();
+        break;
+    default:
+        before = cpucycles_begin();
+        q_sort(l);
+        after = cpucycles_end();
+        break;
+    }
+    dut_free();
+    *ticks = after - before;
+    return ok;
+}
@@ -12,11 +12,30 @@
 
 #define DROP_SIZE 20
 
-#define DUT_FUNCS  \
-    _(insert_head) \
-    _(insert_tail) \
-    _(remove_head) \
-    _(remove_tail)
+/* Ring size of the concurrent queue measured, above the fill of 10000 */
+#define MPMC_MEASURE_CAPACITY 16384
+
+#define DUT_FUNCS         \
+    _(size)               \
+    _(insert_head)        \
+    _(insert_tail)        \
+    _(remove_head)        \
+    _(remove_tail)        \
+    _(mpmc_insert_tail)   \
+    _(mpmc_remove_head)   \
+    _(uq_insert_head)     \
+    _(uq_insert_tail)     \
+    _(uq_remove_head)     \
+    _(uq_remove_tail)
+
+/* Operations whose running time is classified against the queue size,
+ * along with the complexity each one must not exceed
+ */
+#define DUT_SCALING_FUNCS \
+    _(delete_mid, O_N)    \
+    _(reverse, O_N)       \
+    _(sort, O_N_LOG_N)    \
+    _(merge, O_N)
 
 #define DUT(x) DUT_##x
 
@@ -24,13 +43,23 @@ enum {
 #define _(x) DUT(x),
     DUT_FUNCS
 #undef _
+#define _(x, bound) DUT(x),
+    DUT_SCALING_FUNCS
+#undef _
 };
 
+/* Complexity classes told apart by the scaling test, in increasing order */
+typedef enum { O_1, O_N, O_N_LOG_N, O_N_SQUARED } complexity_t;
+
+/* Number of sorted queues q_merge() gets to merge in the scaling test */
+#define MERGE_QUEUES 4
+
 void init_dut();
 void prepare_inputs(uint8_t *input_data, uint8_t *classes);
 bool measure(int64_t *before_ticks,
              int64_t *after_ticks,
              uint8_t *input_data,
              int mode);
+bool measure_scaling(int64_t *ticks, int64_t *walk_ticks, int n, int mode);
 
 #endif
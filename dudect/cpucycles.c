@@ -0,0 +1,176 @@
+/**
+ * Cycle counter backends for dudect.
+ *
+ * The architectural counter needs no setup.  The perf_event backend opens a
+ * cycle counter for the calling process and maps its control page, through
+ * which the kernel tells user space which hardware counter to read and what
+ * to add to it.  See the comment above struct perf_event_mmap_page in
+ * <linux/perf_event.h> for the protocol.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "../report.h"
+
+#include "cpucycles.h"
+
+/* Number of empty measurements taken to calibrate the overhead */
+#define CALIBRATE_ROUNDS 10000
+
+int dudect_timer = CPUCYCLES_COUNTER;
+int64_t cpucycles_overhead = 0;
+uint32_t cpucycles_perf_index = 0;
+
+#if defined(__linux__)
+static int perf_fd = -1;
+static volatile struct perf_event_mmap_page *perf_page = NULL;
+static size_t perf_page_size;
+
+static inline uint64_t read_pmc(uint32_t idx)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo;
+    __asm__ volatile("lfence\n\trdpmc\n\tlfence"
+                     : "=a"(lo), "=d"(hi)
+                     : "c"(idx)
+                     : "memory");
+    return ((uint64_t) lo) | (((uint64_t) hi) << 32);
+#elif defined(__aarch64__)
+    uint64_t val;
+    /* perf only hands out the dedicated cycle counter, index 31, for a
+     * PERF_COUNT_HW_CPU_CYCLES event opened with user access.
+     */
+    (void) idx;
+    asm volatile("isb\n\tmrs %0, pmccntr_el0\n\tisb" : "=r"(val)::"memory");
+    return val;
+#else
+    (void) idx;
+    return 0;
+#endif
+}
+#endif
+
+int64_t cpucycles_perf(void)
+{
+#if defined(__linux__)
+    uint32_t seq, idx;
+    int64_t count;
+
+    do {
+        seq = perf_page->lock;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        idx = perf_page->index;
+        count = perf_page->offset;
+        if (idx) {
+            uint16_t width = perf_page->pmc_width;
+            int64_t pmc = read_pmc(idx - 1);
+            /* sign-extend the counter from its width */
+            pmc <<= 64 - width;
+            pmc >>= 64 - width;
+            count += pmc;
+        }
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    } while (perf_page->lock != seq);
+    return count;
+#else
+    return 0;
+#endif
+}
+
+static void perf_close(void)
+{
+#if defined(__linux__)
+    if (perf_page)
+        munmap((void *) perf_page, perf_page_size);
+    if (perf_fd >= 0)
+        close(perf_fd);
+    perf_page = NULL;
+    perf_fd = -1;
+#endif
+    cpucycles_perf_index = 0;
+}
+
+static bool perf_open(void)
+{
+#if defined(__linux__) && (defined(__i386__) || defined(__x86_64__) || \
+                           defined(__aarch64__))
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+#if defined(__aarch64__)
+    /* config1 bit 1 asks for user access, as in the "rdpmc" format
+     * attribute of the armv8 PMU driver; bit 0 for the 64-bit counter.
+     */
+    attr.config1 = 0x3;
+#endif
+
+    perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perf_fd < 0)
+        return false;
+
+    perf_page_size = sysconf(_SC_PAGESIZE);
+    void *p = mmap(NULL, perf_page_size, PROT_READ, MAP_SHARED, perf_fd, 0);
+    if (p == MAP_FAILED) {
+        perf_page = NULL;
+        perf_close();
+        return false;
+    }
+    perf_page = p;
+
+    /* The index is only valid while the event is scheduled on this CPU, and
+     * zero when the kernel does not let user space read the counter.
+     */
+    if (!perf_page->cap_user_rdpmc || !perf_page->index) {
+        perf_close();
+        return false;
+    }
+#if defined(__aarch64__)
+    if (perf_page->index != 32) {
+        perf_close();
+        return false;
+    }
+#endif
+    cpucycles_perf_index = perf_page->index;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* Take the fastest of many measurements of no work at all */
+static int64_t calibrate(void)
+{
+    int64_t best = INT64_MAX;
+
+    for (int i = 0; i < CALIBRATE_ROUNDS; i++) {
+        int64_t before = cpucycles_begin();
+        int64_t after = cpucycles_end();
+        if (after - before < best)
+            best = after - before;
+    }
+    return best > 0 ? best : 0;
+}
+
+void cpucycles_setup(void)
+{
+    perf_close();
+    if (dudect_timer == CPUCYCLES_PERF && !perf_open()) {
+        report(1, "WARNING: perf_event cycle counter is not available, "
+                  "falling back to the architectural counter");
+        dudect_timer = CPUCYCLES_COUNTER;
+    }
+    cpucycles_overhead = calibrate();
+}
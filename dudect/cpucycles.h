@@ -3,12 +3,49 @@
 
 #include <stdint.h>
 
+/* Timer backends selectable through dudect_timer */
+enum {
+    /* The architectural counter: fenced rdtsc/rdtscp on x86, and the
+     * virtual counter cntvct_el0 behind isb on Arm64.
+     */
+    CPUCYCLES_COUNTER = 0,
+    /* The core cycle counter, read from user space through a perf_event
+     * mmap page: rdpmc on x86, pmccntr_el0 on Arm64.
+     */
+    CPUCYCLES_PERF = 1,
+};
+
+/* Timer backend used by measure().  Backends that are not available fall
+ * back to CPUCYCLES_COUNTER.
+ */
+extern int dudect_timer;
+
+/* Ticks a measurement of no work at all takes on the active backend */
+extern int64_t cpucycles_overhead;
+
+/* Index of the perf_event counter to read, or 0 if CPUCYCLES_PERF is off */
+extern uint32_t cpucycles_perf_index;
+
+int64_t cpucycles_perf(void);
+
+/**
+ * cpucycles_setup() - Prepare the backend chosen by dudect_timer
+ *
+ * Opens the perf_event counter if needed and calibrates cpucycles_overhead.
+ * Counters are per process, so every process measuring calls this itself.
+ */
+void cpucycles_setup(void);
+
 // http://www.intel.com/content/www/us/en/embedded/training/ia-32-ia-64-benchmark-code-execution-paper.html
-static inline int64_t cpucycles(void)
+static inline int64_t cpucycles_counter_begin(void)
 {
 #if defined(__i386__) || defined(__x86_64__)
     unsigned int hi, lo;
-    __asm__ volatile("rdtsc\n\t" : "=a"(lo), "=d"(hi));
+    /* lfence waits for earlier instructions to complete, and keeps later ones
+     * from starting, so no work leaks across the timestamp.
+     */
+    __asm__ volatile("lfence\n\trdtsc\n\tlfence"
+                     : "=a"(lo), "=d"(hi)::"memory");
     return ((int64_t) lo) | (((int64_t) hi) << 32);
 
 #elif defined(__aarch64__)
@@ -19,11 +56,55 @@ static inline int64_t cpucycles(void)
      * bits wide and it is attributed with the flag 'cap_user_time_short'
      * is true.
      */
-    asm volatile("mrs %0, cntvct_el0" : "=r"(val));
+    asm volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(val)::"memory");
     return val;
 #else
 #error Unsupported Architecture
 #endif
 }
 
+static inline int64_t cpucycles_counter_end(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo, aux;
+    /* rdtscp waits for the measured code to complete; the lfence keeps the
+     * code that follows from starting before the timestamp is taken.
+     */
+    __asm__ volatile("rdtscp\n\tlfence"
+                     : "=a"(lo), "=d"(hi), "=c"(aux)::"memory");
+    (void) aux;
+    return ((int64_t) lo) | (((int64_t) hi) << 32);
+
+#elif defined(__aarch64__)
+    uint64_t val;
+    asm volatile("isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"(val)::"memory");
+    return val;
+#endif
+}
+
+/* Take the timestamps around the measured code with cpucycles_begin() and
+ * cpucycles_end(), which serialize in opposite directions.
+ *
+ * cpucycles_begin() first reads the timer once and throws the result away.
+ * After setup code that sweeps the caches, such as filling a queue with
+ * thousands of elements, the timer's own code and data would otherwise be
+ * fetched inside the measured window.
+ */
+static inline int64_t cpucycles_begin(void)
+{
+    if (cpucycles_perf_index) {
+        (void) cpucycles_perf();
+        return cpucycles_perf();
+    }
+    (void) cpucycles_counter_end();
+    return cpucycles_counter_begin();
+}
+
+static inline int64_t cpucycles_end(void)
+{
+    if (cpucycles_perf_index)
+        return cpucycles_perf();
+    return cpucycles_counter_end();
+}
+
 #endif
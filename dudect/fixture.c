@@ -26,23 +26,50 @@
  *    variable time.
  */
 
+/* sched_setaffinity() and cpu_set_t are GNU extensions */
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
 #include <assert.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "../console.h"
 #include "../random.h"
 
 #include "constant.h"
+#include "cpucycles.h"
 #include "fixture.h"
 #include "ttest.h"
 
 #define ENOUGH_MEASURE 10000
 #define TEST_TRIES 10
 
+/* Upper bound on dudect_workers */
+#define MAX_WORKERS 64
+
+/* Number of cropped t-tests, each at a different percentile */
+#define N_PERCENTILES 100
+
+/* The uncropped test, the cropped ones, and the second-order test */
+#define N_TESTS (1 + N_PERCENTILES + 1)
+#define SECOND_ORDER_TEST (N_TESTS - 1)
+
+/* Samples a test needs per class before it takes part in the verdict, and
+ * before the second-order test starts centering on the uncropped mean
+ */
+#define TEST_MIN_MEASURE (ENOUGH_MEASURE / 10)
+
+int dudect_workers = 0;
+
+/* The whole battery of N_TESTS tests */
 static t_context_t *t;
 
 /* threshold values for Welch's t-test */
@@ -51,21 +78,100 @@ enum {
     t_threshold_moderate = 10, /* Test failed */
 };
 
+/* Buffers for one batch of N_MEASURES measurements, reused between batches */
+typedef struct {
+    int64_t *before_ticks;
+    int64_t *after_ticks;
+    int64_t *exec_times;
+    uint8_t *classes;
+    uint8_t *input_data;
+} batch_t;
+
+/* What a worker process sends back once it is done */
+typedef struct {
+    t_context_t ctx[N_TESTS];
+    bool ok;
+} worker_result_t;
+
 static void __attribute__((noreturn)) die(void)
 {
     exit(111);
 }
 
+static void batch_init(batch_t *b)
+{
+    b->before_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
+    b->after_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
+    b->exec_times = calloc(N_MEASURES, sizeof(int64_t));
+    b->classes = calloc(N_MEASURES, sizeof(uint8_t));
+    b->input_data = calloc(N_MEASURES * CHUNK_SIZE, sizeof(uint8_t));
+
+    if (!b->before_ticks || !b->after_ticks || !b->exec_times ||
+        !b->classes || !b->input_data) {
+        die();
+    }
+}
+
+static void batch_free(batch_t *b)
+{
+    free(b->before_ticks);
+    free(b->after_ticks);
+    free(b->exec_times);
+    free(b->classes);
+    free(b->input_data);
+}
+
 static void differentiate(int64_t *exec_times,
                           const int64_t *before_ticks,
                           const int64_t *after_ticks)
 {
+    /* Both classes pay the same cpucycles_overhead, which the t-tests do
+     * not see, so it stays in.  Taking it off would push the fastest
+     * measurements to zero or below, and drop them from one class more
+     * often than from the other.
+     */
     for (size_t i = 0; i < N_MEASURES; i++)
         exec_times[i] = after_ticks[i] - before_ticks[i];
 }
 
-static void update_statistics(const int64_t *exec_times, uint8_t *classes)
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Set the cropping thresholds of one batch from its own execution times.
+ * The thresholds get denser towards the right tail: the i-th one keeps the
+ * fastest 1 - 0.5^(1 + 9 * (i + 1) / N_PERCENTILES) of the measurements, so
+ * that every crop keeps more than half of them.  Narrower crops only see the
+ * fastest few, where a difference of a couple of ticks between the classes
+ * reaches a large t long before it means anything.
+ */
+static void prepare_percentiles(int64_t *percentiles,
+                                const int64_t *exec_times)
+{
+    int64_t sorted[N_MEASURES];
+    size_t n = 0;
+
+    for (size_t i = 0; i < N_MEASURES; i++) {
+        if (exec_times[i] > 0)
+            sorted[n++] = exec_times[i];
+    }
+    qsort(sorted, n, sizeof(int64_t), cmp_int64);
+
+    for (size_t i = 0; i < N_PERCENTILES; i++) {
+        double which = 1 - pow(0.5, 1 + 9.0 * (i + 1) / N_PERCENTILES);
+        percentiles[i] = n ? sorted[(size_t) (which * n)] : 0;
+    }
+}
+
+static void update_statistics(t_context_t *ctx,
+                              const int64_t *exec_times,
+                              uint8_t *classes)
 {
+    int64_t percentiles[N_PERCENTILES];
+
+    prepare_percentiles(percentiles, exec_times);
     for (size_t i = 0; i < N_MEASURES; i++) {
         int64_t difference = exec_times[i];
         /* CPU cycle counter overflowed or dropped measurement */
@@ -73,24 +179,63 @@ static void update_statistics(const int64_t *exec_times, uint8_t *classes)
             continue;
 
         /* do a t-test on the execution time */
-        t_push(t, difference, classes[i]);
+        t_push(&ctx[0], difference, classes[i]);
+
+        /* do a t-test on cropped execution times, for several cropping
+         * thresholds.  Ticks are coarse, so keep the ties with a threshold
+         * rather than let it split them by chance.
+         */
+        for (size_t crop = 0; crop < N_PERCENTILES; crop++) {
+            if (difference <= percentiles[crop])
+                t_push(&ctx[crop + 1], difference, classes[i]);
+        }
+
+        /* do a second-order test (only if we have more than a few
+         * measurements), comparing the variances through the squared
+         * distance to the mean.
+         */
+        if (ctx[0].n[0] > TEST_MIN_MEASURE) {
+            double centered = difference - ctx[0].mean[classes[i]];
+            t_push(&ctx[SECOND_ORDER_TEST], centered * centered, classes[i]);
+        }
+    }
+}
+
+/* Return the test with the largest |t| among those with enough samples */
+static t_context_t *max_test(void)
+{
+    t_context_t *max = &t[0];
+    double max_t = fabs(t_compute(&t[0]));
+
+    for (size_t i = 1; i < N_TESTS; i++) {
+        if (t[i].n[0] <= TEST_MIN_MEASURE || t[i].n[1] <= TEST_MIN_MEASURE)
+            continue;
+        double x = fabs(t_compute(&t[i]));
+        if (x > max_t) {
+            max_t = x;
+            max = &t[i];
+        }
     }
+    return max;
 }
 
 static bool report(void)
 {
-    double max_t = fabs(t_compute(t));
-    double number_traces_max_t = t->n[0] + t->n[1];
-    double max_tau = max_t / sqrt(number_traces_max_t);
+    double number_traces = t[0].n[0] + t[0].n[1];
 
     printf("\033[A\033[2K");
-    printf("meas: %7.2lf M, ", (number_traces_max_t / 1e6));
-    if (number_traces_max_t < ENOUGH_MEASURE) {
+    printf("meas: %7.2lf M, ", (number_traces / 1e6));
+    if (number_traces < ENOUGH_MEASURE) {
         printf("not enough measurements (%.0f still to go).\n",
-               ENOUGH_MEASURE - number_traces_max_t);
+               ENOUGH_MEASURE - number_traces);
         return false;
     }
 
+    t_context_t *test = max_test();
+    double max_t = fabs(t_compute(test));
+    double number_traces_max_t = test->n[0] + test->n[1];
+    double max_tau = max_t / sqrt(number_traces_max_t);
+
     /* max_t: the t statistic value
      * max_tau: a t value normalized by sqrt(number of measurements).
      *          this way we can compare max_tau taken with different
@@ -116,56 +261,166 @@ static bool report(void)
     return true;
 }
 
-static bool doit(int mode)
+/* Measure one batch, leaving the execution times in @b */
+static bool measure_batch(batch_t *b, int mode)
 {
-    int64_t *before_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
-    int64_t *after_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
-    int64_t *exec_times = calloc(N_MEASURES, sizeof(int64_t));
-    uint8_t *classes = calloc(N_MEASURES, sizeof(uint8_t));
-    uint8_t *input_data = calloc(N_MEASURES * CHUNK_SIZE, sizeof(uint8_t));
+    prepare_inputs(b->input_data, b->classes);
 
-    if (!before_ticks || !after_ticks || !exec_times || !classes ||
-        !input_data) {
-        die();
+    bool ret = measure(b->before_ticks, b->after_ticks, b->input_data, mode);
+    differentiate(b->exec_times, b->before_ticks, b->after_ticks);
+    return ret;
+}
+
+static bool doit(batch_t *b, int mode)
+{
+    bool ret = measure_batch(b, mode);
+    update_statistics(t, b->exec_times, b->classes);
+    ret &= report();
+    return ret;
+}
+
+/* Pin the calling process to the @idx-th CPU it is allowed to run on.
+ * Restricting qtest with taskset(1) therefore decides which cores the
+ * workers use.
+ */
+static void pin_to_cpu(int idx)
+{
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) ||
+        !CPU_COUNT(&allowed))
+        return;
+
+    idx %= CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed) || idx--)
+            continue;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+        return;
     }
+#endif
+}
 
-    prepare_inputs(input_data, classes);
+/* Body of a worker process: measure every @stride-th of @batches batches,
+ * starting with batch @idx, on a private queue.
+ */
+static void __attribute__((noreturn))
+worker(int fd, int idx, int stride, int batches, int mode)
+{
+    worker_result_t res = {.ok = true};
+    batch_t b;
 
-    bool ret = measure(before_ticks, after_ticks, input_data, mode);
-    differentiate(exec_times, before_ticks, after_ticks);
-    update_statistics(exec_times, classes);
-    ret &= report();
+    pin_to_cpu(idx);
+    cpucycles_setup();
+    batch_init(&b);
+    init_dut();
+    for (size_t i = 0; i < N_TESTS; i++)
+        t_init(&res.ctx[i]);
+    for (int i = idx; i < batches; i += stride) {
+        res.ok &= measure_batch(&b, mode);
+        update_statistics(res.ctx, b.exec_times, b.classes);
+    }
 
-    free(before_ticks);
-    free(after_ticks);
-    free(exec_times);
-    free(classes);
-    free(input_data);
+    bool sent = write(fd, &res, sizeof(res)) == sizeof(res);
+    _exit(sent ? 0 : 111);
+}
+
+/* Read exactly @n bytes unless the other end goes away */
+static bool read_all(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r <= 0)
+            return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+/* Spread @batches batches over dudect_workers processes and merge their
+ * statistics into t.  Every batch crops at its own thresholds, so the tests
+ * of the workers can be merged one by one.  Processes rather than threads
+ * keep the test harness and the queue under test private to each worker.
+ */
+static bool doit_parallel(int mode, int batches)
+{
+    int workers = dudect_workers < MAX_WORKERS ? dudect_workers : MAX_WORKERS;
+    pid_t pids[MAX_WORKERS];
+    int fds[MAX_WORKERS];
+
+    /* Do not let the workers flush our pending output */
+    fflush(stdout);
+    for (int i = 0; i < workers; i++) {
+        int pfd[2];
+        if (pipe(pfd))
+            die();
+        pids[i] = fork();
+        if (pids[i] < 0)
+            die();
+        if (pids[i] == 0) {
+            close(pfd[0]);
+            worker(pfd[1], i, workers, batches, mode);
+        }
+        close(pfd[1]);
+        fds[i] = pfd[0];
+    }
+
+    bool ret = true;
+    for (int i = 0; i < workers; i++) {
+        worker_result_t res;
+        if (read_all(fds[i], &res, sizeof(res))) {
+            for (size_t j = 0; j < N_TESTS; j++)
+                t_merge(&t[j], &res.ctx[j]);
+            ret &= res.ok;
+        } else {
+            ret = false;
+        }
+        close(fds[i]);
+        waitpid(pids[i], NULL, 0);
+    }
 
+    ret &= report();
     return ret;
 }
 
 static void init_once(void)
 {
     init_dut();
-    t_init(t);
+    for (size_t i = 0; i < N_TESTS; i++)
+        t_init(&t[i]);
 }
 
 static bool test_const(char *text, int mode)
 {
     bool result = false;
-    t = malloc(sizeof(t_context_t));
+    int batches = ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1;
+    batch_t b;
+
+    t = malloc(N_TESTS * sizeof(t_context_t));
+    if (!t)
+        die();
+    batch_init(&b);
+    cpucycles_setup();
 
     for (int cnt = 0; cnt < TEST_TRIES; ++cnt) {
         printf("Testing %s...(%d/%d)\n\n", text, cnt, TEST_TRIES);
         init_once();
-        for (int i = 0; i < ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1;
-             ++i)
-            result = doit(mode);
+        if (dudect_workers > 1) {
+            result = doit_parallel(mode, batches);
+        } else {
+            for (int i = 0; i < batches; ++i)
+                result = doit(&b, mode);
+        }
         printf("\033[A\033[2K\033[A\033[2K");
         if (result)
             break;
     }
+    batch_free(&b);
     free(t);
     return result;
 }
@@ -176,3 +431,149 @@ static bool test_const(char *text, int mode)
 #define _(x) DUT_FUNC_IMPL(x)
 DUT_FUNCS
 #undef _
+
+/* Queue sizes of the scaling test go from 2^SCALING_MIN_LOG2 to
+ * 2^SCALING_MAX_LOG2, doubling each time
+ */
+#define SCALING_MIN_LOG2 8
+#define SCALING_MAX_LOG2 13
+#define SCALING_SIZES (SCALING_MAX_LOG2 - SCALING_MIN_LOG2 + 1)
+
+/* Number of consecutive sizes the complexity is fitted on */
+#define SCALING_WINDOW 4
+
+/* Calls timed per size, of which the median is kept */
+#define SCALING_REPEAT 15
+
+/* Factor by which a class has to fit better than a slower growing one */
+#define CLASSIFY_MARGIN 4
+
+static const char *complexity_names[] = {"O(1)", "O(n)", "O(n log n)",
+                                         "O(n^2)"};
+
+static double complexity_fn(complexity_t c, double n)
+{
+    switch (c) {
+    case O_1:
+        return 1;
+    case O_N:
+        return n;
+    case O_N_LOG_N:
+        return n * log2(n);
+    default:
+        return n * n;
+    }
+}
+
+/* Find the complexity class that fits the measured costs best.
+ *
+ * For each class f, the ratios cost / f(n) should not depend on n.  Take
+ * the spread of their logarithms, so that every size weighs the same.  A
+ * faster growing class has to beat the best slower one by CLASSIFY_MARGIN,
+ * since over a few doublings n and n log n differ by less than the noise.
+ */
+static complexity_t classify(const double *n, const double *cost, int count)
+{
+    complexity_t best = O_1;
+    double best_spread = INFINITY;
+
+    for (complexity_t c = O_1; c <= O_N_SQUARED; c++) {
+        double ratio[SCALING_SIZES], mean = 0, spread = 0;
+        for (int i = 0; i < count; i++) {
+            ratio[i] = log(cost[i] / complexity_fn(c, n[i]));
+            mean += ratio[i] / count;
+        }
+        for (int i = 0; i < count; i++)
+            spread += (ratio[i] - mean) * (ratio[i] - mean);
+        if (spread * CLASSIFY_MARGIN < best_spread) {
+            best_spread = spread;
+            best = c;
+        }
+    }
+    return best;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Median time of one call on @n elements, and median time of walking over
+ * one of them
+ */
+static bool measure_cost(double *cost, double *walk, int n, int mode)
+{
+    double samples[SCALING_REPEAT], walks[SCALING_REPEAT];
+
+    for (int r = 0; r < SCALING_REPEAT; r++) {
+        int64_t ticks, walk_ticks;
+        if (!measure_scaling(&ticks, &walk_ticks, n, mode))
+            return false;
+        samples[r] = ticks - cpucycles_overhead;
+        walks[r] = (double) (walk_ticks - cpucycles_overhead) / n;
+    }
+    qsort(samples, SCALING_REPEAT, sizeof(double), cmp_double);
+    qsort(walks, SCALING_REPEAT, sizeof(double), cmp_double);
+    *cost = samples[SCALING_REPEAT / 2];
+    *walk = walks[SCALING_REPEAT / 2];
+    return true;
+}
+
+/* Find the SCALING_WINDOW consecutive sizes over which walking costs the
+ * same per element.  Those queues sit in the same level of the memory
+ * hierarchy, so that moving between levels does not pass for a faster
+ * growth than the operation has.
+ */
+static int flattest_window(const double *walk)
+{
+    int best = 0;
+    double best_ratio = INFINITY;
+
+    for (int i = 0; i + SCALING_WINDOW <= SCALING_SIZES; i++) {
+        double lo = INFINITY, hi = 0;
+        for (int j = i; j < i + SCALING_WINDOW; j++) {
+            lo = fmin(lo, walk[j]);
+            hi = fmax(hi, walk[j]);
+        }
+        if (lo > 0 && hi / lo < best_ratio) {
+            best_ratio = hi / lo;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static bool test_scaling(char *text, int mode, complexity_t bound)
+{
+    double n[SCALING_SIZES], cost[SCALING_SIZES], walk[SCALING_SIZES];
+
+    cpucycles_setup();
+    init_dut();
+    printf("Testing %s...\n", text);
+
+    /* warm up the caches and the allocator on the largest size */
+    if (!measure_cost(&cost[0], &walk[0], 1 << SCALING_MAX_LOG2, mode))
+        return false;
+
+    for (int i = 0; i < SCALING_SIZES; i++) {
+        n[i] = 1 << (SCALING_MIN_LOG2 + i);
+        if (!measure_cost(&cost[i], &walk[i], n[i], mode))
+            return false;
+        printf("n: %6.0f, ticks: %10.0f, walk: %5.1f\n", n[i], cost[i],
+               walk[i]);
+    }
+
+    int from = flattest_window(walk);
+    complexity_t c = classify(&n[from], &cost[from], SCALING_WINDOW);
+    printf("%s is probably %s for n from %.0f to %.0f\n", text,
+           complexity_names[c], n[from], n[from + SCALING_WINDOW - 1]);
+    return c <= bound;
+}
+
+#define DUT_SCALING_IMPL(op, bound) \
+    bool is_##op##_scaling(void) { return test_scaling(#op, DUT(op), bound); }
+
+#define _(x, bound) DUT_SCALING_IMPL(x, bound)
+DUT_SCALING_FUNCS
+#undef _
@@ -4,9 +4,19 @@
 #include <stdbool.h>
 #include "constant.h"
 
+/* Number of processes measuring in parallel in simulation mode.
+ * Values below 2 keep the measurements in the calling process.
+ */
+extern int dudect_workers;
+
 /* Interface to test if function is constant */
 #define _(x) bool is_##x##_const(void);
 DUT_FUNCS
 #undef _
 
+/* Interface to test if function scales no worse than its bound */
+#define _(x, bound) bool is_##x##_scaling(void);
+DUT_SCALING_FUNCS
+#undef _
+
 #endif
@@ -1,7 +1,9 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,9 +26,21 @@
 /* Value at end of every block */
 #define MAGICFOOTER 0xbeefdead
 
+/* Value at start of every block carved out of a slab */
+#define MAGICARENA 0xcafebabe
+
+/* Value when deallocate block carved out of a slab */
+#define MAGICARENAFREE 0xbabecafe
+
 /* Byte to fill newly malloced space with */
 #define FILLCHAR 0x55
 
+/* Payload bytes of every slab used in arena mode */
+#define SLAB_SIZE (1 << 20)
+
+/* Largest request served from a slab; bigger ones use a block of their own */
+#define ARENA_MAX_BLOCK (SLAB_SIZE >> 4)
+
 /* Data structures used by our code */
 
 /* Represent allocated blocks as doubly-linked list, with
@@ -40,12 +54,59 @@ typedef struct __block_element {
     /* Also place magic number at tail of every block */
 } block_element_t;
 
+/* In arena mode, small blocks are carved out of slabs. A slab is an
+ * ordinary allocated block, so only slabs appear in the allocated list and
+ * in allocated_count. Every carved block has its own header and footer,
+ * which keeps the corruption and double-free checks working.
+ */
+typedef struct {
+    size_t live; /* Blocks handed out and not yet freed */
+    size_t used; /* Bytes handed out so far */
+    unsigned char data[0];
+} slab_t;
+
+typedef struct {
+    slab_t *slab; /* Slab this block was carved out of */
+    size_t payload_size;
+    size_t magic_header; /* Must be immediately before the payload */
+    unsigned char payload[0];
+    /* Also place magic number at tail of every block */
+} arena_block_t;
+
+/* Serializes the bookkeeping below, for code under test that allocates or
+ * frees on threads of its own.  The mutex checks its owner, so that
+ * exception_setup() can release it after the time limit unwinds the thread
+ * holding it, and does nothing otherwise.
+ */
+static pthread_mutex_t heap_lock;
+static pthread_once_t heap_lock_once = PTHREAD_ONCE_INIT;
+
 static block_element_t *allocated = NULL;
 static size_t allocated_count = 0;
 
+/* What the code under test holds, see heap_stats_t */
+static heap_stats_t stats;
+
+/* Slab that new arena blocks are carved out of */
+static slab_t *arena_slab = NULL;
+
+/* Hash index of the payloads of live blocks, carved arena blocks included,
+ * so that cautious mode can tell whether a pointer was handed out without
+ * walking the allocated list or reading memory around it.
+ * Open addressing with linear probing; the table is kept at most half full.
+ */
+static void **block_index = NULL;
+static size_t block_index_size = 0; /* Number of slots, a power of 2 */
+static size_t block_index_count = 0;
+
+#define BLOCK_INDEX_MIN 1024
+
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/* Carve queue elements out of large slabs */
+int arena_mode = 0;
+
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
 static bool error_occurred = false;
@@ -57,9 +118,36 @@ static int time_limit = 1;
 static jmp_buf env;
 static volatile sig_atomic_t jmp_ready = false;
 static bool time_limited = false;
+static pthread_t jmp_thread; /* the only thread that may unwind to env */
+
+/* Called when a guarded section starts and when it ends, see
+ * set_exception_hooks()
+ */
+static void (*section_enter)(void) = NULL, (*section_leave)(void) = NULL;
+static bool section_open = false;
 
 /* Internal functions */
 
+static void heap_lock_init()
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+    pthread_mutex_init(&heap_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void heap_acquire()
+{
+    pthread_once(&heap_lock_once, heap_lock_init);
+    pthread_mutex_lock(&heap_lock);
+}
+
+static void heap_release()
+{
+    pthread_mutex_unlock(&heap_lock);
+}
+
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
@@ -67,6 +155,105 @@ static bool fail_allocation()
     return (weight < 0.01 * fail_probability);
 }
 
+/* Account for a block of @size bytes handed out */
+static void stats_alloc(size_t size)
+{
+    stats.blocks++;
+    stats.mallocs++;
+    stats.payload_bytes += size;
+    if (stats.payload_bytes > stats.peak_payload_bytes)
+        stats.peak_payload_bytes = stats.payload_bytes;
+}
+
+/* Account for a block of @size bytes given back */
+static void stats_free(size_t size)
+{
+    stats.blocks--;
+    stats.frees++;
+    stats.payload_bytes -= size;
+}
+
+/* Home slot of payload @p in a table with @size slots (Fibonacci hashing) */
+static size_t index_slot(const void *p, size_t size)
+{
+    uint64_t h = (uint64_t) (uintptr_t) p * 0x9e3779b97f4a7c15ULL;
+    return (size_t) (h >> 32) & (size - 1);
+}
+
+/* Return the slot holding payload @p, or a free slot if @p is not indexed */
+static size_t index_lookup(const void *p)
+{
+    size_t mask = block_index_size - 1;
+    size_t i = index_slot(p, block_index_size);
+    while (block_index[i] && block_index[i] != p)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static bool index_contains(const void *p)
+{
+    return block_index && block_index[index_lookup(p)] == p;
+}
+
+/* Double the table, or create it, and rehash every block */
+static void index_grow()
+{
+    size_t size = block_index_size ? block_index_size << 1 : BLOCK_INDEX_MIN;
+    void **table = calloc(size, sizeof(void *));
+    if (!table) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        return;
+    }
+
+    for (size_t i = 0; i < block_index_size; i++) {
+        void *p = block_index[i];
+        if (!p)
+            continue;
+        size_t j = index_slot(p, size);
+        while (table[j])
+            j = (j + 1) & (size - 1);
+        table[j] = p;
+    }
+
+    free(block_index);
+    block_index = table;
+    block_index_size = size;
+}
+
+static void index_insert(void *p)
+{
+    if (2 * (block_index_count + 1) > block_index_size)
+        index_grow();
+    block_index[index_lookup(p)] = p;
+    block_index_count++;
+}
+
+/* Remove payload @p, shifting back later members of its probe sequence
+ * instead of leaving tombstones behind.
+ */
+static void index_remove(const void *p)
+{
+    if (!block_index)
+        return;
+
+    size_t mask = block_index_size - 1;
+    size_t i = index_lookup(p);
+    if (!block_index[i])
+        return;
+    block_index_count--;
+
+    for (size_t j = (i + 1) & mask; block_index[j]; j = (j + 1) & mask) {
+        size_t k = index_slot(block_index[j], block_index_size);
+        /* Move the entry at j into the hole unless its home lies in (i, j] */
+        bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stays) {
+            block_index[i] = block_index[j];
+            i = j;
+        }
+    }
+    block_index[i] = NULL;
+}
+
 /* Find header of block, given its payload.
  * Signal error if doesn't seem like legitimate block
  */
@@ -79,22 +266,6 @@ static block_element_t *find_header(void *p)
 
     block_element_t *b =
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
-    if (cautious_mode) {
-        /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
-            report_event(MSG_ERROR,
-                         "Attempted to free unallocated block.  Address = %p",
-                         p);
-            error_occurred = true;
-        }
-    }
-
     if (b->magic_header != MAGICHEADER) {
         report_event(
             MSG_ERROR,
@@ -115,6 +286,156 @@ static size_t *find_footer(block_element_t *b)
     return p;
 }
 
+/* Allocate a block and link it into the allocated list.
+ * Returns NULL if the system is out of memory.
+ */
+static block_element_t *block_new(size_t size)
+{
+    block_element_t *new_block =
+        malloc(size + sizeof(block_element_t) + sizeof(size_t));
+    if (!new_block) {
+        report_event(MSG_WARN, "Couldn't allocate any more memory");
+        return NULL;
+    }
+
+    new_block->magic_header = MAGICHEADER;
+    new_block->payload_size = size;
+    *find_footer(new_block) = MAGICFOOTER;
+    new_block->next = allocated;
+    new_block->prev = NULL;
+
+    if (allocated)
+        allocated->prev = new_block;
+    allocated = new_block;
+    index_insert(new_block->payload);
+    allocated_count++;
+    stats.system_bytes += size + sizeof(block_element_t) + sizeof(size_t);
+    if (stats.system_bytes > stats.peak_system_bytes)
+        stats.peak_system_bytes = stats.system_bytes;
+
+    return new_block;
+}
+
+/* Poison a block and return it to the system */
+static void block_release(block_element_t *b)
+{
+    b->magic_header = MAGICFREE;
+    *find_footer(b) = MAGICFREE;
+    memset(b->payload, FILLCHAR, b->payload_size);
+
+    /* Unlink from list */
+    block_element_t *bn = b->next;
+    block_element_t *bp = b->prev;
+    if (bp)
+        bp->next = bn;
+    else
+        allocated = bn;
+    if (bn)
+        bn->prev = bp;
+    index_remove(b->payload);
+
+    stats.system_bytes -=
+        b->payload_size + sizeof(block_element_t) + sizeof(size_t);
+    free(b);
+    allocated_count--;
+}
+
+/* Given pointer to the slab header, find the block that holds the slab */
+static block_element_t *slab_block(slab_t *slab)
+{
+    return (block_element_t *) ((size_t) slab - sizeof(block_element_t));
+}
+
+/* Given pointer to an arena block, find its footer */
+static size_t *arena_footer(arena_block_t *a)
+{
+    return (size_t *) ((size_t) a + a->payload_size + sizeof(arena_block_t));
+}
+
+/* Carve a block out of the current slab, starting a new slab if needed.
+ * Returns NULL if no new slab can be allocated.
+ */
+static void *arena_malloc(size_t size)
+{
+    /* Keep every carved header aligned on a pointer boundary */
+    size_t need = sizeof(arena_block_t) + size + sizeof(size_t);
+    need = (need + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    if (!arena_slab || arena_slab->used + need > SLAB_SIZE) {
+        /* The old slab is released once its last block is freed */
+        block_element_t *b = block_new(sizeof(slab_t) + SLAB_SIZE);
+        if (!b)
+            return NULL;
+        arena_slab = (slab_t *) &b->payload;
+        arena_slab->live = 0;
+        arena_slab->used = 0;
+    }
+
+    arena_block_t *a = (arena_block_t *) &arena_slab->data[arena_slab->used];
+    arena_slab->used += need;
+    arena_slab->live++;
+
+    a->slab = arena_slab;
+    a->payload_size = size;
+    a->magic_header = MAGICARENA;
+    *arena_footer(a) = MAGICFOOTER;
+    memset(a->payload, FILLCHAR, size);
+    index_insert(a->payload);
+    return a->payload;
+}
+
+/* Return a carved block to its slab.  A slab is handed back to the system
+ * when its last block goes away, except for the current slab, which is
+ * simply rewound.
+ */
+static void arena_free(void *p)
+{
+    arena_block_t *a = (arena_block_t *) ((size_t) p - sizeof(arena_block_t));
+    slab_t *slab = a->slab;
+
+    if (cautious_mode) {
+        /* Make sure the owning slab is really an allocated block */
+        if (!index_contains(slab) ||
+            (size_t) p < (size_t) slab->data ||
+            (size_t) p >= (size_t) &slab->data[slab->used]) {
+            report_event(MSG_ERROR,
+                         "Attempted to free unallocated block.  Address = %p",
+                         p);
+            error_occurred = true;
+            return;
+        }
+    }
+
+    if (a->magic_header != MAGICARENA) {
+        report_event(
+            MSG_ERROR,
+            "Attempted to free unallocated or corrupted block.  Address = %p",
+            p);
+        error_occurred = true;
+        return;
+    }
+
+    if (*arena_footer(a) != MAGICFOOTER) {
+        report_event(MSG_ERROR,
+                     "Corruption detected in block with address %p when "
+                     "attempting to free it",
+                     p);
+        error_occurred = true;
+    }
+    a->magic_header = MAGICARENAFREE;
+    *arena_footer(a) = MAGICFREE;
+    index_remove(p);
+    memset(p, FILLCHAR, a->payload_size);
+    stats_free(a->payload_size);
+
+    if (--slab->live)
+        return;
+    if (slab == arena_slab)
+        slab->used = 0;
+    else
+        block_release(slab_block(slab));
+}
+
 /* Implementation of application functions */
 
 void *test_malloc(size_t size)
@@ -129,30 +450,23 @@ void *test_malloc(size_t size)
         return NULL;
     }
 
-    block_element_t *new_block =
-        malloc(size + sizeof(block_element_t) + sizeof(size_t));
-    if (!new_block) {
-        report_event(MSG_FATAL, "Couldn't allocate any more memory");
-        error_occurred = true;
+    heap_acquire();
+    if (arena_mode && size <= ARENA_MAX_BLOCK) {
+        void *p = arena_malloc(size);
+        if (p)
+            stats_alloc(size);
+        heap_release();
+        return p;
     }
 
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->payload_size = size;
-    *find_footer(new_block) = MAGICFOOTER;
+    block_element_t *new_block = block_new(size);
+    if (new_block)
+        stats_alloc(size);
+    heap_release();
+    if (!new_block)
+        return NULL;
     void *p = (void *) &new_block->payload;
     memset(p, FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
-
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
-
     return p;
 }
 
@@ -178,7 +492,26 @@ void test_free(void *p)
     if (!p)
         return;
 
+    heap_acquire();
+    /* Make sure this is really an allocated block before reading its header */
+    if (cautious_mode && !index_contains(p)) {
+        report_event(MSG_ERROR,
+                     "Attempted to free unallocated block.  Address = %p", p);
+        error_occurred = true;
+        heap_release();
+        return;
+    }
+
+    /* Both kinds of header keep their magic number right before payload */
+    size_t magic = ((size_t *) p)[-1];
+    if (magic == MAGICARENA || magic == MAGICARENAFREE) {
+        arena_free(p);
+        heap_release();
+        return;
+    }
+
     block_element_t *b = find_header(p);
+    stats_free(b->payload_size);
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
         report_event(MSG_ERROR,
@@ -187,22 +520,8 @@ void test_free(void *p)
                      p);
         error_occurred = true;
     }
-    b->magic_header = MAGICFREE;
-    *find_footer(b) = MAGICFREE;
-    memset(p, FILLCHAR, b->payload_size);
-
-    /* Unlink from list */
-    block_element_t *bn = b->next;
-    block_element_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
-    else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
-
-    free(b);
-    allocated_count--;
+    block_release(b);
+    heap_release();
 }
 
 // cppcheck-suppress unusedFunction
@@ -218,7 +537,30 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    heap_acquire();
+    /* An idle slab held for reuse does not count as a leak */
+    if (arena_slab && !arena_slab->live) {
+        block_release(slab_block(arena_slab));
+        arena_slab = NULL;
+    }
+    size_t cnt = allocated_count;
+    heap_release();
+    return cnt;
+}
+
+void heap_stats(heap_stats_t *out)
+{
+    heap_acquire();
+    *out = stats;
+    heap_release();
+}
+
+void heap_stats_reset_peak()
+{
+    heap_acquire();
+    stats.peak_payload_bytes = stats.payload_bytes;
+    stats.peak_system_bytes = stats.system_bytes;
+    heap_release();
 }
 
 /* Implementation of functions for testing */
@@ -232,7 +574,9 @@ void set_cautious_mode(bool cautious)
 }
 
 /* Set/unset restricted allocation mode.
- * In this mode, calls to malloc and free are disallowed.
+ * In this mode, calls to malloc and free are disallowed, on every thread.
+ * Threads started after the call see the new mode, so the workers of
+ * q_sort_parallel() are held to it as well.
  */
 void set_noallocate_mode(bool noallocate)
 {
@@ -247,6 +591,19 @@ bool error_check()
     return e;
 }
 
+void set_exception_hooks(void (*enter)(void), void (*leave)(void))
+{
+    section_enter = enter;
+    section_leave = leave;
+}
+
+static void section_end()
+{
+    if (section_open && section_leave)
+        section_leave();
+    section_open = false;
+}
+
 /* Prepare for a risky operation using setjmp.
  * Function returns true for initial return, false for error return
  */
@@ -254,7 +611,10 @@ bool exception_setup(bool limit_time)
 {
     if (sigsetjmp(env, 1)) {
         /* Got here from longjmp */
+        section_end();
         jmp_ready = false;
+        /* Unwinding may have skipped the unlock in test_malloc/test_free */
+        heap_release();
         if (time_limited) {
             alarm(0);
             time_limited = false;
@@ -267,17 +627,23 @@ bool exception_setup(bool limit_time)
     }
 
     /* Got here from initial call */
+    jmp_thread = pthread_self();
     jmp_ready = true;
     if (limit_time) {
         alarm(time_limit);
         time_limited = true;
     }
+    /* A section left without exception_cancel() ends at the next one */
+    if (!section_open && section_enter)
+        section_enter();
+    section_open = true;
     return true;
 }
 
 /* Call once past risky code */
 void exception_cancel()
 {
+    section_end();
     if (time_limited) {
         alarm(0);
         time_limited = false;
@@ -292,8 +658,10 @@ void trigger_exception(char *msg)
 {
     error_occurred = true;
     error_message = msg;
-    if (jmp_ready)
+    if (jmp_ready && pthread_equal(pthread_self(), jmp_thread))
         siglongjmp(env, 1);
-    else
-        exit(1);
+    /* Another thread cannot unwind the one that set up the exception */
+    if (jmp_ready)
+        report_event(MSG_FATAL, "%s", msg);
+    exit(1);
 }
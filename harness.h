@@ -18,12 +18,44 @@ char *test_strdup(const char *s);
 
 #ifdef INTERNAL
 
-/* Report number of allocated blocks */
+/* Report number of allocated blocks.
+ * A slab still holding blocks carved out in arena mode counts as one block.
+ */
 size_t allocation_check();
 
+/**
+ * heap_stats_t - Memory held by the code under test, as the harness sees it
+ * @blocks: blocks handed out by test_malloc() and not freed yet
+ * @payload_bytes: bytes requested for those blocks
+ * @system_bytes: bytes taken from malloc() for them, which adds the header
+ *                and footer of every block and, in arena mode, whole slabs
+ * @peak_payload_bytes: most @payload_bytes held since the peaks were reset
+ * @peak_system_bytes: most @system_bytes held since the peaks were reset
+ * @mallocs: blocks handed out so far
+ * @frees: blocks freed so far
+ */
+typedef struct {
+    size_t blocks;
+    size_t payload_bytes;
+    size_t system_bytes;
+    size_t peak_payload_bytes;
+    size_t peak_system_bytes;
+    size_t mallocs;
+    size_t frees;
+} heap_stats_t;
+
+/* Copy the current heap statistics to @stats */
+void heap_stats(heap_stats_t *stats);
+
+/* Start measuring the peaks from what is held now */
+void heap_stats_reset_peak();
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Nonzero to carve small blocks out of large slabs */
+extern int arena_mode;
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
@@ -47,7 +79,15 @@ bool exception_setup(bool limit_time);
 /* Call once past risky code */
 void exception_cancel();
 
+/* Set functions called right after exception_setup() starts a guarded
+ * section, and right before exception_cancel() or an exception ends it.
+ * Either may be NULL.
+ */
+void set_exception_hooks(void (*enter)(void), void (*leave)(void));
+
 /* Use longjmp to return to most recent exception setup.  Include error message
+ * Only the thread that set up the exception can return there; on any other
+ * thread the error is fatal.
  */
 void trigger_exception(char *msg);
 
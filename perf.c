@@ -0,0 +1,243 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "perf.h"
+
+const char *const perf_event_names[PERF_EVENTS] = {
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_L1D_MISSES] = "L1D misses",
+    [PERF_LLC_MISSES] = "LLC misses",
+    [PERF_BRANCH_MISSES] = "branch misses",
+    [PERF_DTLB_MISSES] = "dTLB misses",
+    [PERF_PAGE_FAULTS] = "page faults",
+};
+
+#if defined(__linux__)
+
+/* Config of a PERF_TYPE_HW_CACHE event counting read misses in @cache */
+#define CACHE_READ_MISS(cache)                      \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[PERF_EVENTS] = {
+    [PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [PERF_L1D_MISSES] = {PERF_TYPE_HW_CACHE,
+                         CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    [PERF_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    [PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [PERF_DTLB_MISSES] = {PERF_TYPE_HW_CACHE,
+                          CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    [PERF_PAGE_FAULTS] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+/* How long to wait for a group to get onto the PMU, in nanoseconds */
+#define PROBE_NS 20000000
+
+/* Events scheduled onto the PMU together.  The first one leads. */
+typedef struct {
+    int fds[PERF_EVENTS];
+    int event_of[PERF_EVENTS];
+    int nfds;
+} group_t;
+
+static group_t groups[PERF_EVENTS];
+static int ngroups = 0;
+
+/* Number of events open, over all groups */
+static int nevents = 0;
+
+static int event_open(int event, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[event].type;
+    attr.config = events[event].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    /* Members follow the leader, which starts disabled */
+    attr.disabled = group_fd < 0;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/* Add @event to @g, as its leader if @g is empty */
+static void group_add(group_t *g, int event)
+{
+    int fd = event_open(event, g->nfds ? g->fds[0] : -1);
+    if (fd < 0)
+        return;
+    g->fds[g->nfds] = fd;
+    g->event_of[g->nfds++] = event;
+}
+
+static void group_close(group_t *g)
+{
+    for (int i = 0; i < g->nfds; i++)
+        close(g->fds[i]);
+    g->nfds = 0;
+}
+
+/* Read @g into @buf: nr, time enabled, time running, then one value per
+ * event.  Return false if that did not work.
+ */
+static bool group_read(const group_t *g, uint64_t buf[3 + PERF_EVENTS])
+{
+    ssize_t len = read(g->fds[0], buf, (3 + PERF_EVENTS) * sizeof(uint64_t));
+    return len >= (ssize_t) (3 * sizeof(uint64_t)) &&
+           buf[0] == (uint64_t) g->nfds;
+}
+
+/* Whether @g gets onto the PMU once enabled.  A group is scheduled all or
+ * nothing, and one with more hardware events than the counters left free,
+ * for example by the NMI watchdog, never runs at all.
+ */
+static bool group_runs(const group_t *g)
+{
+    uint64_t buf[3 + PERF_EVENTS];
+    bool runs = false;
+
+    ioctl(g->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    do {
+        if (!group_read(g, buf))
+            break;
+        runs = buf[2] > 0;
+    } while (!runs && buf[1] < PROBE_NS);
+    ioctl(g->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    ioctl(g->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    return runs;
+}
+
+/* Put all hardware events in one group, so that they count over exactly the
+ * same instructions.  If that group cannot get onto the PMU, give every
+ * hardware event a group of its own instead, to be multiplexed one by one.
+ * Software events do not take a counter and each get a group of their own.
+ */
+int perf_counters_open(void)
+{
+    if (ngroups)
+        return nevents;
+
+    group_t *hw = &groups[ngroups];
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        if (events[i].type != PERF_TYPE_SOFTWARE)
+            group_add(hw, i);
+    }
+    if (hw->nfds > 1 && !group_runs(hw)) {
+        group_close(hw);
+        for (int i = 0; i < PERF_EVENTS; i++) {
+            if (events[i].type != PERF_TYPE_SOFTWARE)
+                group_add(&groups[ngroups++], i);
+        }
+    } else {
+        ngroups++;
+    }
+
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        if (events[i].type == PERF_TYPE_SOFTWARE)
+            group_add(&groups[ngroups++], i);
+    }
+
+    /* Drop the groups whose only event failed to open */
+    int n = 0;
+    nevents = 0;
+    for (int i = 0; i < ngroups; i++) {
+        if (groups[i].nfds) {
+            nevents += groups[i].nfds;
+            groups[n++] = groups[i];
+        }
+    }
+    ngroups = n;
+    return nevents;
+}
+
+void perf_counters_close(void)
+{
+    for (int i = 0; i < ngroups; i++)
+        group_close(&groups[i]);
+    ngroups = 0;
+    nevents = 0;
+}
+
+static void group_ioctl(unsigned long request)
+{
+    for (int i = 0; i < ngroups; i++)
+        ioctl(groups[i].fds[0], request, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_counters_reset(void)
+{
+    group_ioctl(PERF_EVENT_IOC_RESET);
+}
+
+void perf_counters_start(void)
+{
+    group_ioctl(PERF_EVENT_IOC_ENABLE);
+}
+
+void perf_counters_stop(void)
+{
+    group_ioctl(PERF_EVENT_IOC_DISABLE);
+}
+
+bool perf_counters_read(perf_counts_t *counts)
+{
+    memset(counts, 0, sizeof(*counts));
+    if (!ngroups)
+        return false;
+
+    for (int g = 0; g < ngroups; g++) {
+        uint64_t buf[3 + PERF_EVENTS];
+        if (!group_read(&groups[g], buf))
+            return false;
+
+        uint64_t enabled = buf[1], running = buf[2];
+        for (int i = 0; i < groups[g].nfds; i++) {
+            int event = groups[g].event_of[i];
+            /* A group that never got onto the PMU counted nothing at all */
+            counts->valid[event] = running > 0 || !enabled;
+            counts->count[event] =
+                running && running < enabled
+                    ? (uint64_t) ((double) buf[3 + i] * enabled / running)
+                    : buf[3 + i];
+        }
+    }
+    return true;
+}
+
+#else /* !__linux__ */
+
+int perf_counters_open(void)
+{
+    return 0;
+}
+
+void perf_counters_close(void) {}
+
+void perf_counters_reset(void) {}
+
+void perf_counters_start(void) {}
+
+void perf_counters_stop(void) {}
+
+bool perf_counters_read(perf_counts_t *counts)
+{
+    memset(counts, 0, sizeof(*counts));
+    return false;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef LAB0_PERF_H
+#define LAB0_PERF_H
+
+/* Hardware event counters around queue operations, through perf_event_open.
+ *
+ * The hardware events are opened as one group on the calling thread, so
+ * that they count over exactly the same instructions.  The kernel schedules
+ * a group onto the PMU all or nothing: if the group does not fit the
+ * counters left free, it never runs, and each hardware event is opened as a
+ * group of its own instead.  Software events, such as page faults, take no
+ * counter and are opened on their own.  The kernel multiplexes groups that
+ * do not all fit at once, and the counts are scaled by the share of time
+ * each group was running.  Threads the operation starts, like the workers of
+ * q_sort_parallel(), are not counted.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Events counted, in reporting order */
+enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_PAGE_FAULTS,
+    PERF_EVENTS
+};
+
+/* Name of each event, as reported */
+extern const char *const perf_event_names[PERF_EVENTS];
+
+/**
+ * perf_counts_t - Counts of the events since perf_counters_reset()
+ * @count: count of every event, scaled for multiplexing
+ * @valid: whether the event was opened and ran at all
+ */
+typedef struct {
+    uint64_t count[PERF_EVENTS];
+    bool valid[PERF_EVENTS];
+} perf_counts_t;
+
+/**
+ * perf_counters_open() - Open the counters for the calling thread, stopped
+ *
+ * Events the kernel or the CPU does not support are left out.
+ *
+ * Return: the number of events opened, 0 if none could be.
+ */
+int perf_counters_open(void);
+
+/* Close the counters, if open */
+void perf_counters_close(void);
+
+/* Zero all counts */
+void perf_counters_reset(void);
+
+/* Start counting, adding to the counts so far */
+void perf_counters_start(void);
+
+/* Stop counting */
+void perf_counters_stop(void);
+
+/**
+ * perf_counters_read() - Read the counts of all events
+ * @counts: where to store them
+ *
+ * Return: false if the counters are not open or could not be read.
+ */
+bool perf_counters_read(perf_counts_t *counts);
+
+#endif /* LAB0_PERF_H */
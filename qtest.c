@@ -2,13 +2,20 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h> /* strcasecmp */
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -19,12 +26,16 @@
 #include <time.h>
 #endif
 
+#include "dudect/cpucycles.h"
 #include "dudect/fixture.h"
 #include "list.h"
 #include "random.h"
 
 /* Shannon entropy */
 extern double shannon_entropy(const uint8_t *input_data);
+extern void shannon_entropy_batch(const uint8_t *const input_data[],
+                                  size_t n,
+                                  double *entropy);
 extern int show_entropy;
 
 /* Our program needs to use regular malloc/free */
@@ -43,8 +54,10 @@ extern int show_entropy;
  * solution code
  */
 #include "queue.h"
+#include "unrolled.h"
 
 #include "console.h"
+#include "perf.h"
 #include "report.h"
 
 /* Settable parameters */
@@ -53,7 +66,6 @@ extern int show_entropy;
 
 /* How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
  */
 #define BIG_LIST_SIZE 30
 
@@ -67,12 +79,45 @@ typedef struct {
 static queue_chain_t chain = {.size = 0};
 static queue_contex_t *current = NULL;
 
+/* Whether queues are held by the unrolled backend (-u) */
+static bool unrolled = false;
+
+/* Queue of the chain.  With the unrolled backend, @uq holds its elements,
+ * and the list at @ctx.q is only filled in while a command the backend
+ * does not implement runs, see do_bridged().
+ */
+typedef struct {
+    queue_contex_t ctx;
+    uq_t *uq;
+} queue_backend_t;
+
+static uq_t *uq_of(queue_contex_t *qctx)
+{
+    return container_of(qctx, queue_backend_t, ctx)->uq;
+}
+
+/* Free a queue of the chain along with its context */
+static void queue_release(queue_contex_t *qctx)
+{
+    q_free(qctx->q);
+    uq_free(uq_of(qctx));
+    free(container_of(qctx, queue_backend_t, ctx));
+}
+
 /* How many times can queue operations fail */
 static int fail_limit = BIG_LIST_SIZE;
 static int fail_count = 0;
 
 static int string_length = MAXSTRING;
 
+/* Threads sort runs on, through q_sort_parallel() when more than one */
+static int sort_threads = 1;
+
+/* Whether a command may have relinked nodes away from the ends of a queue
+ * since q_show() last checked all of it
+ */
+static bool queue_rearranged = false;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -99,9 +144,6 @@ static bool do_free(int argc, char *argv[])
     }
     error_check();
 
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
     struct list_head *qnext = NULL;
     if (chain.size > 1) {
         qnext = ((uintptr_t) current->chain.next == (uintptr_t) &chain.head)
@@ -115,11 +157,11 @@ static bool do_free(int argc, char *argv[])
         if (exception_setup(true))
             q_free(current->q);
         exception_cancel();
-        set_cautious_mode(true);
     }
 
     if (current) {
-        free(current);
+        uq_free(uq_of(current));
+        free(container_of(current, queue_backend_t, ctx));
         chain.size--;
         current = qnext ? list_entry(qnext, queue_contex_t, chain) : NULL;
     }
@@ -137,6 +179,26 @@ static bool do_free(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Append an empty queue to the chain and make it current */
+static void chain_add()
+{
+    queue_backend_t *qb = malloc(sizeof(queue_backend_t));
+    queue_contex_t *qctx = &qb->ctx;
+    list_add_tail(&qctx->chain, &chain.head);
+
+    qctx->size = 0;
+    qctx->q = q_new();
+    qb->uq = unrolled && qctx->q ? uq_new() : NULL;
+    if (unrolled && !qb->uq) {
+        /* Either half missing makes a null queue */
+        q_free(qctx->q);
+        qctx->q = NULL;
+    }
+    qctx->id = chain.size++;
+
+    current = qctx;
+}
+
 static bool do_new(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -146,16 +208,8 @@ static bool do_new(int argc, char *argv[])
 
     bool ok = true;
 
-    if (exception_setup(true)) {
-        queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
-        list_add_tail(&qctx->chain, &chain.head);
-
-        qctx->size = 0;
-        qctx->q = q_new();
-        qctx->id = chain.size++;
-
-        current = qctx;
-    }
+    if (exception_setup(true))
+        chain_add();
     exception_cancel();
     q_show(3);
 
@@ -177,6 +231,99 @@ static void fill_rand_string(char *buf, size_t buf_size)
     buf[len] = '\0';
 }
 
+/* Supplier of strings for bulk insertion: @arg itself, or random strings if
+ * it is NULL
+ */
+static const char *insert_string(void *arg, size_t i)
+{
+    static char randstr_buf[MAX_RANDSTR_LEN];
+
+    (void) i;
+    if (arg)
+        return arg;
+    fill_rand_string(randstr_buf, sizeof(randstr_buf));
+    return randstr_buf;
+}
+
+/* Insert @reps strings with a single call to the bulk interface, and check
+ * that every element it put at the end of the queue owns a copy of its
+ * string.  @inserts is NULL for random strings, a new one per element.
+ */
+static bool queue_insert_bulk(position_t pos, char *inserts, int reps)
+{
+    bool ok = true;
+    size_t n =
+        pos == POS_TAIL
+            ? q_insert_tail_bulk(current->q, insert_string, inserts, reps)
+            : q_insert_head_bulk(current->q, insert_string, inserts, reps);
+    current->size += n;
+
+    struct list_head *node = current->q;
+    char *lasts = NULL;
+    for (size_t r = 0; ok && r < n; r++) {
+        node = pos == POS_TAIL ? node->prev : node->next;
+        char *cur_inserts = list_entry(node, element_t, list)->value;
+        if (!cur_inserts) {
+            report(1, "ERROR: Failed to save copy of string in queue");
+            ok = false;
+        } else if (cur_inserts == inserts) {
+            report(1,
+                   "ERROR: Need to allocate and copy string for new "
+                   "queue element");
+            ok = false;
+        } else if (cur_inserts == lasts) {
+            report(1,
+                   "ERROR: Need to allocate separate string for each "
+                   "queue element");
+            ok = false;
+        }
+        lasts = cur_inserts;
+    }
+
+    if (n < (size_t) reps) {
+        fail_count += reps - n;
+        if (fail_count < fail_limit) {
+            report(2, "Insertion of %s failed %zu times",
+                   inserts ? inserts : "RAND", reps - n);
+        } else {
+            report(1, "ERROR: Insertion of %s failed (%d failures total)",
+                   inserts ? inserts : "RAND", fail_count);
+            ok = false;
+        }
+    }
+    return ok && !error_check();
+}
+
+/* Insert @s at one end of the current queue, whichever backend holds it */
+static bool backend_insert(position_t pos, char *s)
+{
+    if (unrolled)
+        return pos == POS_TAIL ? uq_insert_tail(uq_of(current), s)
+                               : uq_insert_head(uq_of(current), s);
+    return pos == POS_TAIL ? q_insert_tail(current->q, s)
+                           : q_insert_head(current->q, s);
+}
+
+/* Element at one end of the current queue */
+static element_t *backend_end(position_t pos)
+{
+    if (unrolled)
+        return pos == POS_TAIL ? uq_tail(uq_of(current))
+                               : uq_head(uq_of(current));
+    return pos == POS_TAIL ? list_last_entry(current->q, element_t, list)
+                           : list_first_entry(current->q, element_t, list);
+}
+
+/* Remove the element at one end of the current queue */
+static element_t *backend_remove(position_t pos, char *sp, size_t bufsize)
+{
+    if (unrolled)
+        return pos == POS_TAIL ? uq_remove_tail(uq_of(current), sp, bufsize)
+                               : uq_remove_head(uq_of(current), sp, bufsize);
+    return pos == POS_TAIL ? q_remove_tail(current->q, sp, bufsize)
+                           : q_remove_head(current->q, sp, bufsize);
+}
+
 /* insertion */
 static bool queue_insert(position_t pos, int argc, char *argv[])
 {
@@ -185,8 +332,13 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
         }
-        bool ok =
-            pos == POS_TAIL ? is_insert_tail_const() : is_insert_head_const();
+        bool ok;
+        if (unrolled)
+            ok = pos == POS_TAIL ? is_uq_insert_tail_const()
+                                 : is_uq_insert_head_const();
+        else
+            ok = pos == POS_TAIL ? is_insert_tail_const()
+                                 : is_insert_head_const();
         if (!ok) {
             report(1,
                    "ERROR: Probably not constant time or wrong implementation");
@@ -223,19 +375,23 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                pos == POS_TAIL ? "tail" : "head");
     error_check();
 
+    /* The unrolled backend inserts one at a time */
+    if (current && reps > 1 && !unrolled) {
+        if (exception_setup(true))
+            ok = queue_insert_bulk(pos, need_rand ? NULL : inserts, reps);
+        exception_cancel();
+        q_show(3);
+        return ok;
+    }
+
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
-                                        : q_insert_head(current->q, inserts);
+            bool rval = backend_insert(pos, inserts);
             if (rval) {
                 current->size++;
-                element_t *entry =
-                    pos == POS_TAIL
-                        ? list_last_entry(current->q, element_t, list)
-                        : list_first_entry(current->q, element_t, list);
-                char *cur_inserts = entry->value;
+                char *cur_inserts = backend_end(pos)->value;
                 if (!cur_inserts) {
                     report(1, "ERROR: Failed to save copy of string in queue");
                     ok = false;
@@ -285,6 +441,63 @@ static bool do_it(int argc, char *argv[])
     return queue_insert(POS_TAIL, argc, argv);
 }
 
+/* Remove @reps elements with a single call to the bulk interface, comparing
+ * each to @checks unless it is NULL
+ */
+static bool queue_remove_bulk(position_t pos, char *checks, int reps)
+{
+    bool ok = true;
+    size_t n = 0;
+    LIST_HEAD(chain);
+
+    if (!current || !current->size)
+        report(3, "Warning: Calling remove %s on empty queue",
+               pos == POS_TAIL ? "tail" : "head");
+    error_check();
+
+    if (current && exception_setup(true)) {
+        if (unrolled) {
+            element_t *e;
+            while (n < (size_t) reps && (e = backend_remove(pos, NULL, 0))) {
+                list_add_tail(&e->list, &chain);
+                n++;
+            }
+        } else {
+            n = pos == POS_TAIL ? q_remove_tail_bulk(current->q, &chain, reps)
+                                : q_remove_head_bulk(current->q, &chain, reps);
+        }
+    }
+    exception_cancel();
+
+    element_t *entry, *safe;
+    list_for_each_entry_safe (entry, safe, &chain, list) {
+        if (ok && checks && strcmp(entry->value, checks)) {
+            report(1, "ERROR: Removed value %s != expected value %s",
+                   entry->value, checks);
+            ok = false;
+        }
+        q_release_element(entry);
+    }
+    if (n) {
+        current->size -= n;
+        report(2, "Removed %zu elements from queue", n);
+    }
+
+    if (n < (size_t) reps) {
+        fail_count++;
+        if (!checks && fail_count < fail_limit) {
+            report(2, "Removal from queue failed");
+        } else {
+            report(1, "ERROR: Removal from queue failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool queue_remove(position_t pos, int argc, char *argv[])
 {
     /* FIXME: It is known that both functions is_remove_tail_const() and
@@ -297,8 +510,13 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
         }
-        bool ok =
-            pos == POS_TAIL ? is_remove_tail_const() : is_remove_head_const();
+        bool ok;
+        if (unrolled)
+            ok = pos == POS_TAIL ? is_uq_remove_tail_const()
+                                 : is_uq_remove_head_const();
+        else
+            ok = pos == POS_TAIL ? is_remove_tail_const()
+                                 : is_remove_head_const();
         if (!ok) {
             report(1,
                    "ERROR: Probably not constant time or wrong implementation");
@@ -309,10 +527,19 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
     }
 #endif
 
-    if (argc != 1 && argc != 2) {
-        report(1, "%s needs 0-1 arguments", argv[0]);
+    if (argc < 1 || argc > 3) {
+        report(1, "%s needs 0-2 arguments", argv[0]);
+        return false;
+    }
+
+    int reps = 1;
+    if (argc == 3 && (!get_int(argv[2], &reps) || reps < 1)) {
+        report(1, "Invalid number of removals '%s'", argv[2]);
         return false;
     }
+    if (reps > 1)
+        return queue_remove_bulk(pos, strcmp(argv[1], "RAND") ? argv[1] : NULL,
+                                 reps);
 
     char *removes = malloc(string_length + STRINGPAD + 1);
     if (!removes) {
@@ -329,7 +556,7 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
         return false;
     }
 
-    bool check = argc > 1;
+    bool check = argc > 1 && strcmp(argv[1], "RAND");
     bool ok = true;
     if (check) {
         strncpy(checks, argv[1], string_length + 1);
@@ -347,9 +574,7 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
 
     element_t *re = NULL;
     if (current && exception_setup(true))
-        re = pos == POS_TAIL
-                 ? q_remove_tail(current->q, removes, string_length + 1)
-                 : q_remove_head(current->q, removes, string_length + 1);
+        re = backend_remove(pos, removes, string_length + 1);
     exception_cancel();
 
     bool is_null = re ? false : true;
@@ -414,10 +639,54 @@ static inline bool do_rt(int argc, char *argv[])
     return queue_remove(POS_TAIL, argc, argv);
 }
 
+/* An element of the copy checked by do_dedup, and where it sits in it */
+typedef struct {
+    const char *value;
+    size_t idx;
+} dedup_item_t;
+
+static int cmp_dedup_item(const void *a, const void *b)
+{
+    return strcmp(((const dedup_item_t *) a)->value,
+                  ((const dedup_item_t *) b)->value);
+}
+
+/* Flag, for each of the @n elements of @l in order, whether another element
+ * holds the same string.  Unless @adjacent, duplicates are brought together
+ * by sorting first.  Return an array allocated with malloc(), or NULL.
+ */
+static bool *find_dups(struct list_head *l, size_t n, bool adjacent)
+{
+    bool *dup = calloc(n + 1, sizeof(bool));
+    dedup_item_t *items = malloc((n + 1) * sizeof(dedup_item_t));
+    if (!dup || !items) {
+        free(dup);
+        free(items);
+        return NULL;
+    }
+
+    size_t i = 0;
+    element_t *item;
+    list_for_each_entry (item, l, list) {
+        items[i].value = item->value;
+        items[i].idx = i;
+        i++;
+    }
+    if (!adjacent)
+        qsort(items, n, sizeof(dedup_item_t), cmp_dedup_item);
+    for (i = 0; i + 1 < n; i++) {
+        if (!strcmp(items[i].value, items[i + 1].value))
+            dup[items[i].idx] = dup[items[i + 1].idx] = true;
+    }
+    free(items);
+    return dup;
+}
+
 static bool do_dedup(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    bool unsorted = argc == 2 && !strcmp(argv[1], "-u");
+    if (argc != 1 && !unsorted) {
+        report(1, "%s takes no arguments other than -u", argv[0]);
         return false;
     }
 
@@ -428,6 +697,7 @@ static bool do_dedup(int argc, char *argv[])
 
     LIST_HEAD(l_copy);
     element_t *item = NULL, *tmp = NULL;
+    size_t n = 0;
 
     // Copy current->q to l_copy
     if (current->q && !list_empty(current->q)) {
@@ -445,6 +715,7 @@ static bool do_dedup(int argc, char *argv[])
             }
             memcpy(tmp->value, item->value, slen);
             list_add_tail(&tmp->list, &l_copy);
+            n++;
         }
         // Return false if the loop does not leave properly
         if (&item->list != current->q) {
@@ -459,47 +730,73 @@ static bool do_dedup(int argc, char *argv[])
         }
     }
 
+    // Sorted input only needs its neighbours compared
+    bool *dup = find_dups(&l_copy, n, !unsorted);
+    if (!dup) {
+        list_for_each_entry_safe (item, tmp, &l_copy, list) {
+            free(item->value);
+            free(item);
+        }
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for "
+               "duplicate checking");
+        return false;
+    }
+
     bool ok = true;
+    queue_rearranged = true;
     if (exception_setup(true))
-        ok = q_delete_dup(current->q);
+        ok = unsorted ? q_delete_dup_unsorted(current->q)
+                      : q_delete_dup(current->q);
     exception_cancel();
 
-    if (!ok) {
+    if (!ok && !unsorted) {
         list_for_each_entry_safe (item, tmp, &l_copy, list) {
             free(item->value);
             free(item);
         }
+        free(dup);
         report(1, "ERROR: Calling delete duplicate on null queue");
         return false;
     }
 
-    struct list_head *l_tmp = current->q->next;
-    bool is_this_dup = false;
-    // Compare between new list and old one
-    list_for_each_entry (item, &l_copy, list) {
-        // Skip comparison with new list if the string is duplicate
-        bool is_next_dup =
-            item->list.next != &l_copy &&
-            strcmp(list_entry(item->list.next, element_t, list)->value,
-                   item->value) == 0;
-        if (is_this_dup || is_next_dup) {
-            // Update list size
-            current->size--;
-        } else if (l_tmp != current->q &&
-                   strcmp(list_entry(l_tmp, element_t, list)->value,
-                          item->value) == 0)
-            l_tmp = l_tmp->next;
-        else
-            ok = false;
-        is_this_dup = is_next_dup;
+    if (!ok) {
+        /* The hash set could not be allocated, and the queue is unchanged */
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Allocation for delete duplicate failed");
+            ok = true;
+        } else {
+            report(1,
+                   "ERROR: Allocation for delete duplicate failed (%d failures "
+                   "total)",
+                   fail_count);
+        }
+    } else {
+        struct list_head *l_tmp = current->q->next;
+        size_t i = 0;
+        // Compare between new list and old one
+        list_for_each_entry (item, &l_copy, list) {
+            // Skip comparison with new list if the string is duplicate
+            if (dup[i++]) {
+                // Update list size
+                current->size--;
+            } else if (l_tmp != current->q &&
+                       strcmp(list_entry(l_tmp, element_t, list)->value,
+                              item->value) == 0)
+                l_tmp = l_tmp->next;
+            else
+                ok = false;
+        }
+        // All elements in new list should be traversed
+        ok = ok && l_tmp == current->q;
+        if (!ok)
+            report(1,
+                   "ERROR: Duplicate strings are in queue or distinct strings "
+                   "are not in queue");
     }
-    // All elements in new list should be traversed
-    ok = ok && l_tmp == current->q;
-    if (!ok)
-        report(1,
-               "ERROR: Duplicate strings are in queue or distinct strings are "
-               "not in queue");
 
+    free(dup);
     list_for_each_entry_safe (item, tmp, &l_copy, list) {
         free(item->value);
         free(item);
@@ -509,8 +806,30 @@ static bool do_dedup(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* In simulation mode, classify how the running time of an operation grows
+ * with the queue size instead of running it on the current queue
+ */
+static bool queue_scaling(bool (*is_scaling)(void), int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s does not need arguments in simulation mode", argv[0]);
+        return false;
+    }
+    if (!is_scaling()) {
+        report(1,
+               "ERROR: Probably worse complexity than expected or wrong "
+               "implementation");
+        return false;
+    }
+    report(1, "Probably within the expected complexity");
+    return true;
+}
+
 static bool do_reverse(int argc, char *argv[])
 {
+    if (simulation)
+        return queue_scaling(is_reverse_scaling, argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -521,8 +840,13 @@ static bool do_reverse(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        q_reverse(current->q);
+    queue_rearranged = true;
+    if (current && exception_setup(true)) {
+        if (unrolled)
+            uq_reverse(uq_of(current));
+        else
+            q_reverse(current->q);
+    }
     exception_cancel();
 
     set_noallocate_mode(false);
@@ -532,6 +856,20 @@ static bool do_reverse(int argc, char *argv[])
 
 static bool do_size(int argc, char *argv[])
 {
+    if (simulation) {
+        if (argc != 1) {
+            report(1, "%s does not need arguments in simulation mode", argv[0]);
+            return false;
+        }
+        if (!is_size_const()) {
+            report(1,
+                   "ERROR: Probably not constant time or wrong implementation");
+            return false;
+        }
+        report(1, "Probably constant time");
+        return true;
+    }
+
     if (argc != 1 && argc != 2) {
         report(1, "%s takes 0-1 arguments", argv[0]);
         return false;
@@ -556,7 +894,7 @@ static bool do_size(int argc, char *argv[])
 
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
-            cnt = q_size(current->q);
+            cnt = unrolled ? uq_size(uq_of(current)) : q_size(current->q);
             ok = ok && !error_check();
         }
     }
@@ -580,6 +918,9 @@ static bool do_size(int argc, char *argv[])
 
 bool do_sort(int argc, char *argv[])
 {
+    if (simulation)
+        return queue_scaling(is_sort_scaling, argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -597,8 +938,13 @@ bool do_sort(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        q_sort(current->q);
+    queue_rearranged = true;
+    if (current && exception_setup(true)) {
+        if (sort_threads > 1)
+            q_sort_parallel(current->q, sort_threads);
+        else
+            q_sort(current->q);
+    }
     exception_cancel();
     set_noallocate_mode(false);
 
@@ -625,6 +971,9 @@ bool do_sort(int argc, char *argv[])
 
 static bool do_dm(int argc, char *argv[])
 {
+    if (simulation)
+        return queue_scaling(is_delete_mid_scaling, argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -637,6 +986,7 @@ static bool do_dm(int argc, char *argv[])
     error_check();
 
     bool ok = true;
+    queue_rearranged = true;
     if (exception_setup(true))
         ok = q_delete_mid(current->q);
     exception_cancel();
@@ -664,6 +1014,7 @@ static bool do_swap(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
+    queue_rearranged = true;
     if (exception_setup(true))
         q_swap(current->q);
     exception_cancel();
@@ -695,8 +1046,10 @@ static bool do_descend(int argc, char *argv[])
         report(3, "Warning: Calling descend on single node");
     error_check();
 
+    queue_rearranged = true;
     if (exception_setup(true))
         current->size = q_descend(current->q);
+    exception_cancel();
     set_noallocate_mode(false);
 
     bool ok = true;
@@ -742,6 +1095,7 @@ static bool do_reverseK(int argc, char *argv[])
     }
 
     set_noallocate_mode(true);
+    queue_rearranged = true;
     if (exception_setup(true))
         q_reverseK(current->q, k);
     exception_cancel();
@@ -753,6 +1107,9 @@ static bool do_reverseK(int argc, char *argv[])
 
 static bool do_merge(int argc, char *argv[])
 {
+    if (simulation)
+        return queue_scaling(is_merge_scaling, argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -766,12 +1123,13 @@ static bool do_merge(int argc, char *argv[])
 
     int len = 0;
     set_noallocate_mode(true);
+    queue_rearranged = true;
     if (current && exception_setup(true))
         len = q_merge(&chain.head);
     exception_cancel();
     set_noallocate_mode(false);
 
-    if (q_size(&chain.head) > 1) {
+    if (chain.size > 1) {
         chain.size = 1;
         current = list_entry(chain.head.next, queue_contex_t, chain);
         current->size = len;
@@ -780,8 +1138,7 @@ static bool do_merge(int argc, char *argv[])
         while ((uintptr_t) cur != (uintptr_t) &chain.head) {
             queue_contex_t *ctx = list_entry(cur, queue_contex_t, chain);
             cur = cur->next;
-            q_free(ctx->q);
-            free(ctx);
+            queue_release(ctx);
         }
 
         chain.head.prev = &current->chain;
@@ -829,6 +1186,107 @@ static bool is_circular()
     return true;
 }
 
+/* Whether do_bridged() has lent the elements of the current queue, or of
+ * every queue, to its list
+ */
+static bool lent = false;
+
+/* How q_show() validates the current queue before printing it */
+typedef enum {
+    CHECK_FULL,        /* walk all of it every time */
+    CHECK_SAMPLED,     /* check the ends, and all of it every check_period */
+    CHECK_INCREMENTAL, /* as sampled, and all of it after a rearrangement */
+} check_policy_t;
+
+static int check_policy = CHECK_FULL;
+
+/* Shows between two full checks when the policy is not full, 0 for never */
+static int check_period = 64;
+static int shows_since_full = 0;
+
+/* Nodes checked at each end of the queue when not checking all of it */
+#define CHECK_WINDOW BIG_LIST_SIZE
+
+/* Whether q_show() has to check the whole queue this time */
+static bool check_all()
+{
+    bool all = check_policy == CHECK_FULL ||
+               (check_policy == CHECK_INCREMENTAL && queue_rearranged) ||
+               (check_period && ++shows_since_full >= check_period);
+    if (all) {
+        shows_since_full = 0;
+        queue_rearranged = false;
+    }
+    return all;
+}
+
+/* Check that the CHECK_WINDOW nodes at each end of the current queue are
+ * linked both ways, which is where the commands that do not rearrange the
+ * queue make their changes
+ */
+static bool ends_linked()
+{
+    struct list_head *head = current->q, *fwd = head, *bwd = head;
+    for (int i = 0; i < CHECK_WINDOW; i++) {
+        if (!fwd->next || fwd->next->prev != fwd || !bwd->prev ||
+            bwd->prev->next != bwd)
+            return false;
+        fwd = fwd->next;
+        bwd = bwd->prev;
+        if (fwd == head)
+            break;
+    }
+    return true;
+}
+
+/* q_show() for a queue held by the unrolled backend.  Only the elements
+ * printed are read; the rest are checked and counted a chunk at a time.
+ */
+static bool uq_show(int vlevel)
+{
+    uq_t *uq = uq_of(current);
+    int cnt = 0, size = 0;
+    const uq_chunk_t *c;
+
+    if (!uq) {
+        report(vlevel, "l = NULL");
+        return true;
+    }
+
+    report_noreturn(vlevel, "l = [");
+    list_for_each_entry (c, &uq->chunks, list) {
+        if (!c->count || c->start + c->count > UQ_CHUNK) {
+            report(vlevel, " ... ]");
+            report(vlevel, "ERROR:  Chunk holds %u elements from slot %u",
+                   c->count, c->start);
+            return false;
+        }
+        for (uint32_t i = c->start;
+             cnt < BIG_LIST_SIZE && i < c->start + c->count; i++, cnt++) {
+            element_t *e = c->slot[i];
+            report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
+            if (show_entropy) {
+                report_noreturn(vlevel, "(%3.2f%%)",
+                                shannon_entropy((const uint8_t *) e->value));
+            }
+        }
+        size += c->count;
+    }
+
+    report(vlevel, size <= BIG_LIST_SIZE ? "]" : " ... ]");
+    if (size > current->size) {
+        report(vlevel, "ERROR:  Queue has more than %d elements",
+               current->size);
+        return false;
+    }
+    return true;
+}
+
+/* Set while q_show() walks the queue after a command, so that option perf
+ * counts only the guarded sections of the command itself
+ */
+static bool showing = false;
+
 static bool q_show(int vlevel)
 {
     bool ok = true;
@@ -841,7 +1299,11 @@ static bool q_show(int vlevel)
         return true;
     }
 
-    if (!is_circular()) {
+    if (unrolled && !lent)
+        return uq_show(vlevel);
+
+    bool all = check_all();
+    if (all ? !is_circular() : !ends_linked()) {
         report(vlevel, "ERROR:  Queue is not doubly circular");
         return false;
     }
@@ -851,8 +1313,12 @@ static bool q_show(int vlevel)
     struct list_head *ori = current->q;
     struct list_head *cur = current->q->next;
 
+    /* Past what is printed, only a full check counts the rest */
+    int limit = all || current->size <= BIG_LIST_SIZE ? current->size
+                                                       : BIG_LIST_SIZE + 1;
+    showing = true;
     if (exception_setup(true)) {
-        while (ok && ori != cur && cnt < current->size) {
+        while (ok && ori != cur && cnt < limit) {
             element_t *e = list_entry(cur, element_t, list);
             if (cnt < BIG_LIST_SIZE) {
                 report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
@@ -868,6 +1334,7 @@ static bool q_show(int vlevel)
         }
     }
     exception_cancel();
+    showing = false;
 
     if (!ok) {
         report(vlevel, " ... ]");
@@ -879,6 +1346,8 @@ static bool q_show(int vlevel)
             report(vlevel, "]");
         else
             report(vlevel, " ... ]");
+    } else if (!all && cnt == limit) {
+        report(vlevel, " ... ]");
     } else {
         report(vlevel, " ... ]");
         report(vlevel, "ERROR:  Queue has more than %d elements",
@@ -889,43 +1358,530 @@ static bool q_show(int vlevel)
     return ok;
 }
 
-static bool do_show(int argc, char *argv[])
+/* Entropy of every string in the current queue, computed in one batch */
+static bool do_audit(int argc, char *argv[])
 {
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
-    if (current)
-        report(1, "Current queue ID: %d", current->id);
-
-    return q_show(0);
-}
-
-static bool do_prev(int argc, char *argv[])
-{
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    if (!current || !current->q) {
+        report(3, "Warning: Calling audit on null queue");
         return false;
     }
 
-    if (!current) {
-        report(3, "Warning: Try to operate null queue");
+    int n = current->size;
+    const uint8_t **strs = calloc(n ? n : 1, sizeof(*strs));
+    double *entropy = malloc((n ? n : 1) * sizeof(*entropy));
+    if (!strs || !entropy) {
+        report(1, "INTERNAL ERROR.  Could not allocate %d entropies", n);
+        free(strs);
+        free(entropy);
         return false;
     }
 
-    struct list_head *prev;
-    if (chain.size > 1) {
-        prev = ((uintptr_t) chain.head.next == (uintptr_t) &current->chain)
-                   ? chain.head.prev
-                   : current->chain.prev;
-        current = prev ? list_entry(prev, queue_contex_t, chain) : NULL;
+    int cnt = 0;
+    if (unrolled) {
+        const uq_chunk_t *c;
+        list_for_each_entry (c, &uq_of(current)->chunks, list) {
+            for (uint32_t i = c->start; cnt < n && i < c->start + c->count;
+                 i++)
+                strs[cnt++] = (const uint8_t *) c->slot[i]->value;
+        }
+    } else {
+        const element_t *e;
+        list_for_each_entry (e, current->q, list) {
+            if (cnt == n)
+                break;
+            strs[cnt++] = (const uint8_t *) e->value;
+        }
     }
 
-    return q_show(0);
+    shannon_entropy_batch(strs, cnt, entropy);
+    double min = cnt ? entropy[0] : 0, max = min, sum = 0;
+    for (int i = 0; i < cnt; i++) {
+        min = entropy[i] < min ? entropy[i] : min;
+        max = entropy[i] > max ? entropy[i] : max;
+        sum += entropy[i];
+    }
+    report(1, "%d strings, entropy min %.2f%%, mean %.2f%%, max %.2f%%", cnt,
+           min, cnt ? sum / cnt : 0, max);
+
+    free(strs);
+    free(entropy);
+    return true;
 }
 
-static bool do_next(int argc, char *argv[])
+/* Snapshot files hold every queue of the chain, in order.  A header is
+ * followed by each queue as its element count and then its strings, each a
+ * length, the bytes and a terminating NUL, so that a mapped file can hand
+ * its strings to the bulk insertion as they are.  Integers are in host byte
+ * order, which the magic number checks.
+ */
+#define SNAPSHOT_MAGIC 0x50414e53 /* "SNAP" */
+#define SNAPSHOT_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t queues;
+} snapshot_header_t;
+
+/* Write the @n elements of @qctx to @f, returning how many it holds */
+static uint64_t snapshot_write_queue(FILE *f, queue_contex_t *qctx, uint64_t n)
+{
+    uint64_t cnt = 0;
+    if (unrolled && !lent) {
+        const uq_chunk_t *c;
+        list_for_each_entry (c, &uq_of(qctx)->chunks, list) {
+            for (uint32_t i = c->start; cnt < n && i < c->start + c->count;
+                 i++, cnt++) {
+                const element_t *e = c->slot[i];
+                uint32_t len = e->len;
+                fwrite(&len, sizeof(len), 1, f);
+                fwrite(e->value, 1, len + 1, f);
+            }
+        }
+    } else {
+        const element_t *e;
+        list_for_each_entry (e, qctx->q, list) {
+            if (cnt == n)
+                break;
+            uint32_t len = e->len;
+            fwrite(&len, sizeof(len), 1, f);
+            fwrite(e->value, 1, len + 1, f);
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+static bool do_save(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s takes a file name", argv[0]);
+        return false;
+    }
+
+    FILE *f = fopen(argv[1], "w");
+    if (!f) {
+        report(1, "Could not create snapshot '%s'", argv[1]);
+        return false;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    snapshot_header_t hdr = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, 0};
+    queue_contex_t *qctx;
+    list_for_each_entry (qctx, &chain.head, chain)
+        hdr.queues++;
+    fwrite(&hdr, sizeof(hdr), 1, f);
+
+    bool ok = true;
+    uint64_t total = 0;
+    list_for_each_entry (qctx, &chain.head, chain) {
+        /* A null queue is saved as an empty one */
+        uint64_t n = qctx->q ? qctx->size : 0;
+        fwrite(&n, sizeof(n), 1, f);
+        if (snapshot_write_queue(f, qctx, n) != n) {
+            report(1, "ERROR: Queue %d holds fewer than %d elements",
+                   qctx->id, qctx->size);
+            ok = false;
+            break;
+        }
+        total += n;
+    }
+
+    if (fclose(f) || !ok) {
+        if (ok)
+            report(1, "Could not write snapshot '%s'", argv[1]);
+        unlink(argv[1]);
+        return false;
+    }
+    report(2, "Saved %" PRIu64 " queues, %" PRIu64 " elements to '%s'",
+           hdr.queues, total, argv[1]);
+    return !error_check();
+}
+
+/* Supplier of strings for bulk insertion from a snapshot: @arg points to
+ * the next string in the mapped file, and is moved past it
+ */
+static const char *snapshot_string(void *arg, size_t i)
+{
+    const char **pos = arg;
+    uint32_t len;
+    memcpy(&len, *pos, sizeof(len));
+    const char *s = *pos + sizeof(len);
+    *pos = s + len + 1;
+    return s;
+}
+
+/* End of the @n strings starting at @p, or NULL if they run past @end */
+static const char *snapshot_strings_end(const char *p,
+                                        const char *end,
+                                        uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        uint32_t len;
+        if ((size_t) (end - p) < sizeof(len))
+            return NULL;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        if ((size_t) (end - p) <= len || p[len])
+            return NULL;
+        p += len + 1;
+    }
+    return p;
+}
+
+static bool do_load(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s takes a file name", argv[0]);
+        return false;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        if (fd >= 0)
+            close(fd);
+        report(1, "Could not open snapshot '%s'", argv[1]);
+        return false;
+    }
+
+    snapshot_header_t hdr;
+    void *map = MAP_FAILED;
+    if ((size_t) st.st_size >= sizeof(hdr))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        report(1, "'%s' is not a snapshot", argv[1]);
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    const char *p = map, *end = p + st.st_size;
+    memcpy(&hdr, p, sizeof(hdr));
+    p += sizeof(hdr);
+    bool ok = hdr.magic == SNAPSHOT_MAGIC && hdr.version == SNAPSHOT_VERSION;
+    if (!ok)
+        report(1, "'%s' is not a snapshot of this version", argv[1]);
+
+    uint64_t total = 0;
+    for (uint64_t q = 0; ok && q < hdr.queues; q++) {
+        uint64_t n;
+        const char *last = NULL;
+        if ((size_t) (end - p) >= sizeof(n)) {
+            memcpy(&n, p, sizeof(n));
+            p += sizeof(n);
+            /* Check every string before the insertion reads them */
+            if (n <= INT_MAX)
+                last = snapshot_strings_end(p, end, n);
+        }
+        if (!last) {
+            report(1, "ERROR: Snapshot '%s' is truncated or corrupt", argv[1]);
+            ok = false;
+            break;
+        }
+
+        size_t cnt = 0;
+        if (exception_setup(true)) {
+            chain_add();
+            /* A null queue is reported below, as a shortfall */
+            if (current->q && unrolled) {
+                uq_t *uq = uq_of(current);
+                for (const char *s = p; cnt < n; cnt++) {
+                    const char *str = snapshot_string(&s, cnt);
+                    if (!uq_insert_tail(uq, (char *) str))
+                        break;
+                }
+            } else if (current->q) {
+                const char *s = p;
+                cnt = q_insert_tail_bulk(current->q, snapshot_string, &s, n);
+            }
+        }
+        exception_cancel();
+
+        current->size += cnt;
+        total += cnt;
+        if (cnt < n) {
+            report(1,
+                   "ERROR: Loaded %zu of the %" PRIu64
+                   " elements of queue %" PRIu64,
+                   cnt, n, q);
+            ok = false;
+        }
+        p = last;
+    }
+    munmap(map, st.st_size);
+
+    if (ok && p != end)
+        report(1, "Warning: Ignoring data past the queues of '%s'", argv[1]);
+    if (ok)
+        report(2, "Loaded %" PRIu64 " elements from '%s'", total, argv[1]);
+    queue_rearranged = true;
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Memory held by the queues, broken down by what it holds */
+typedef struct {
+    int queues;
+    size_t elements;
+    size_t string_bytes; /* stored inline right after each element */
+    size_t chunks;       /* of the unrolled queues */
+} queue_usage_t;
+
+static void queue_usage(queue_usage_t *u)
+{
+    memset(u, 0, sizeof(*u));
+    queue_contex_t *qctx;
+    list_for_each_entry (qctx, &chain.head, chain) {
+        u->queues++;
+        if (unrolled && !lent) {
+            const uq_chunk_t *c;
+            list_for_each_entry (c, &uq_of(qctx)->chunks, list) {
+                for (uint32_t i = c->start; i < c->start + c->count; i++)
+                    u->string_bytes += c->slot[i]->len + 1;
+                u->elements += c->count;
+                u->chunks++;
+            }
+        } else if (qctx->q) {
+            const element_t *e;
+            list_for_each_entry (e, qctx->q, list) {
+                u->string_bytes += e->len + 1;
+                u->elements++;
+            }
+        }
+    }
+}
+
+/* Lifetime peaks, from before footprint last restarted the harness peaks */
+static size_t peak_payload_bytes, peak_system_bytes;
+
+static void fold_peaks(const heap_stats_t *st)
+{
+    if (st->peak_payload_bytes > peak_payload_bytes)
+        peak_payload_bytes = st->peak_payload_bytes;
+    if (st->peak_system_bytes > peak_system_bytes)
+        peak_system_bytes = st->peak_system_bytes;
+}
+
+static bool do_mem(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    queue_usage_t u;
+    heap_stats_t st;
+    queue_usage(&u);
+    heap_stats(&st);
+    fold_peaks(&st);
+
+    size_t nodes = u.elements * sizeof(element_t);
+    size_t chunks = u.chunks * sizeof(uq_chunk_t);
+    size_t counted = nodes + u.string_bytes + chunks;
+    size_t overhead = st.system_bytes - st.payload_bytes;
+    double per_element = u.elements ? 1.0 / u.elements : 0;
+
+    report(1, "%d queues holding %zu elements in %zu blocks", u.queues,
+           u.elements, st.blocks);
+    report(1, "  element nodes    %12zu bytes, %6.1f per element", nodes,
+           nodes * per_element);
+    report(1, "  strings          %12zu bytes, %6.1f per element",
+           u.string_bytes, u.string_bytes * per_element);
+    if (unrolled)
+        report(1, "  unrolled chunks  %12zu bytes, %6.1f per element", chunks,
+               chunks * per_element);
+    report(1, "  queue headers    %12zu bytes",
+           st.payload_bytes > counted ? st.payload_bytes - counted : 0);
+    report(1, "  harness overhead %12zu bytes, %6.1f per block%s", overhead,
+           st.blocks ? (double) overhead / st.blocks : 0,
+           arena_mode ? ", slabs included" : "");
+    report(1, "  total            %12zu bytes, peak %zu bytes (%zu requested)",
+           st.system_bytes, peak_system_bytes, peak_payload_bytes);
+    report(1, "%zu allocations, %zu frees so far", st.mallocs, st.frees);
+    return true;
+}
+
+/* Report the memory use of every command */
+static int footprint = 0;
+
+/* What the harness held when the command being measured started */
+static heap_stats_t footprint_start;
+static bool footprint_armed = false;
+
+static void footprint_before()
+{
+    footprint_armed = footprint;
+    if (!footprint_armed)
+        return;
+
+    heap_stats(&footprint_start);
+    fold_peaks(&footprint_start);
+    heap_stats_reset_peak();
+}
+
+static void footprint_after(const char *name)
+{
+    if (!footprint_armed)
+        return;
+    footprint_armed = false;
+
+    heap_stats_t st;
+    heap_stats(&st);
+    fold_peaks(&st);
+
+    const heap_stats_t *s0 = &footprint_start;
+    long blocks = (long) (st.blocks - s0->blocks);
+    long payload = (long) (st.payload_bytes - s0->payload_bytes);
+    long overhead = (long) (st.system_bytes - s0->system_bytes) - payload;
+    report(1,
+           "Footprint of %s: %+ld blocks (%zu allocations, %zu frees), "
+           "%+ld bytes requested, %+ld bytes of harness overhead, peak +%zu "
+           "bytes",
+           name, blocks, st.mallocs - s0->mallocs, st.frees - s0->frees,
+           payload, overhead, st.peak_system_bytes - s0->system_bytes);
+}
+
+/* Count hardware events over the sections of every command guarded by
+ * exception_setup()
+ */
+static int perf = 0;
+
+/* Guarded sections run by the command being measured */
+static int perf_sections;
+
+/* Elements in all queues when the command started */
+static size_t perf_elements;
+
+static size_t element_total()
+{
+    size_t n = 0;
+    queue_contex_t *qctx;
+    list_for_each_entry (qctx, &chain.head, chain)
+        n += qctx->size;
+    return n;
+}
+
+static void perf_enter()
+{
+    if (showing)
+        return;
+    perf_sections++;
+    perf_counters_start();
+}
+
+static void perf_leave()
+{
+    if (!showing)
+        perf_counters_stop();
+}
+
+static void perf_set(int oldval)
+{
+    if (perf && !oldval) {
+        int n = perf_counters_open();
+        if (!n) {
+            report(1, "Could not open any performance counter");
+            perf = 0;
+            return;
+        }
+        report(1, "Counting %d of %d events", n, PERF_EVENTS);
+        set_exception_hooks(perf_enter, perf_leave);
+    } else if (!perf && oldval) {
+        set_exception_hooks(NULL, NULL);
+        perf_counters_close();
+    }
+}
+
+static void perf_before()
+{
+    perf_sections = 0;
+    perf_elements = element_total();
+    perf_counters_reset();
+}
+
+static void perf_after(const char *name)
+{
+    perf_counts_t c;
+    if (!perf || !perf_sections || !perf_counters_read(&c))
+        return;
+
+    /* Per element of the queues before or after, whichever held more */
+    size_t n = element_total();
+    if (n < perf_elements)
+        n = perf_elements;
+
+    report(1, "Performance counters of %s over %zu elements:", name, n);
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        if (!c.valid[i])
+            continue;
+        report_noreturn(1, "  %-14s %14" PRIu64, perf_event_names[i],
+                        c.count[i]);
+        if (n)
+            report_noreturn(1, ", %10.2f per element",
+                            (double) c.count[i] / n);
+        if (i == PERF_INSTRUCTIONS && c.valid[PERF_CYCLES] &&
+            c.count[PERF_CYCLES])
+            report_noreturn(1, ", %.2f per cycle",
+                            (double) c.count[i] / c.count[PERF_CYCLES]);
+        report(1, "");
+    }
+}
+
+static void command_before(int argc, char *argv[])
+{
+    footprint_before();
+    perf_before();
+}
+
+static void command_after(int argc, char *argv[])
+{
+    footprint_after(argv[0]);
+    perf_after(argv[0]);
+}
+
+static bool do_show(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (current)
+        report(1, "Current queue ID: %d", current->id);
+
+    return q_show(0);
+}
+
+static bool do_prev(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current) {
+        report(3, "Warning: Try to operate null queue");
+        return false;
+    }
+
+    struct list_head *prev;
+    if (chain.size > 1) {
+        prev = ((uintptr_t) chain.head.next == (uintptr_t) &current->chain)
+                   ? chain.head.prev
+                   : current->chain.prev;
+        current = prev ? list_entry(prev, queue_contex_t, chain) : NULL;
+    }
+
+    return q_show(0);
+}
+
+static bool do_next(int argc, char *argv[])
 {
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
@@ -948,6 +1904,570 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+/* Microbenchmark of a single queue operation, see do_bench() */
+
+/* Number of queues whose elements bench merges */
+#define BENCH_MERGE_QUEUES 2
+
+/* Print the bench results as CSV instead of a table */
+static int bench_csv = 0;
+
+/* Element removed by the last rh or rt run of bench */
+static element_t *bench_removed;
+
+static void bench_ih(struct list_head *q)
+{
+    q_insert_head(q, "bench");
+}
+
+static void bench_it(struct list_head *q)
+{
+    q_insert_tail(q, "bench");
+}
+
+static void bench_rh(struct list_head *q)
+{
+    bench_removed = q_remove_head(q, NULL, 0);
+}
+
+static void bench_rt(struct list_head *q)
+{
+    bench_removed = q_remove_tail(q, NULL, 0);
+}
+
+static void bench_size(struct list_head *q)
+{
+    q_size(q);
+}
+
+static void bench_dm(struct list_head *q)
+{
+    q_delete_mid(q);
+}
+
+static void bench_dedup(struct list_head *q)
+{
+    q_delete_dup(q);
+}
+
+static void bench_swap(struct list_head *q)
+{
+    q_swap(q);
+}
+
+static void bench_reverse(struct list_head *q)
+{
+    q_reverse(q);
+}
+
+static void bench_reverseK(struct list_head *q)
+{
+    q_reverseK(q, 3);
+}
+
+static void bench_sort(struct list_head *q)
+{
+    q_sort(q);
+}
+
+static void bench_descend(struct list_head *q)
+{
+    q_descend(q);
+}
+
+/* Takes the chain of queues rather than a queue */
+static void bench_merge(struct list_head *chain_head)
+{
+    q_merge(chain_head);
+}
+
+static const struct {
+    char *name;
+    void (*run)(struct list_head *);
+    bool sorted;      /* operate on sorted queues */
+    bool noallocate;  /* disallow allocation, as the command itself does */
+} bench_ops[] = {
+    {"ih", bench_ih, false, false},
+    {"it", bench_it, false, false},
+    {"rh", bench_rh, false, false},
+    {"rt", bench_rt, false, false},
+    {"size", bench_size, false, false},
+    {"dm", bench_dm, false, false},
+    {"dedup", bench_dedup, true, false},
+    {"swap", bench_swap, false, true},
+    {"reverse", bench_reverse, false, true},
+    {"reverseK", bench_reverseK, false, true},
+    {"sort", bench_sort, false, true},
+    {"descend", bench_descend, false, false},
+    {"merge", bench_merge, true, true},
+};
+
+/* Fill @q with @n random strings.  Return false if an insertion failed, for
+ * example under option malloc.
+ */
+static bool bench_fill(struct list_head *q, int n, bool sorted)
+{
+    char buf[MAX_RANDSTR_LEN];
+    for (int i = 0; i < n; i++) {
+        fill_rand_string(buf, sizeof(buf));
+        if (!q_insert_tail(q, buf)) {
+            report(1, "Could only fill a queue with %d of %d elements", i, n);
+            return false;
+        }
+    }
+    if (sorted)
+        q_sort(q);
+    return true;
+}
+
+static int cmp_ticks(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static int64_t now_ns(void)
+{
+#if defined(__APPLE__)
+    return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (int64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+#endif
+}
+
+/* Rate of the cycle counter against the clock, over about 10 ms */
+static double bench_ns_per_tick(void)
+{
+    int64_t ns = now_ns(), ticks = cpucycles_begin();
+    while (now_ns() - ns < 10000000)
+        ;
+    ticks = cpucycles_end() - ticks;
+    ns = now_ns() - ns;
+    return ticks > 0 ? (double) ns / ticks : 0;
+}
+
+/* Time one run of @op on fresh queues holding @n elements in total */
+static bool bench_once(int op, int n, int64_t *ticks)
+{
+    queue_contex_t ctx[BENCH_MERGE_QUEUES];
+    LIST_HEAD(bench_chain);
+    int queues = bench_ops[op].run == bench_merge ? BENCH_MERGE_QUEUES : 1;
+    bool ok = true;
+
+    for (int i = 0; i < queues; i++) {
+        ctx[i].q = q_new();
+        ctx[i].size = n / queues + (i < n % queues);
+        ctx[i].id = i;
+        if (!ctx[i].q) {
+            queues = i;
+            ok = false;
+            break;
+        }
+        if (!bench_fill(ctx[i].q, ctx[i].size, bench_ops[op].sorted)) {
+            queues = i + 1;
+            ok = false;
+            break;
+        }
+        list_add_tail(&ctx[i].chain, &bench_chain);
+    }
+
+    bench_removed = NULL;
+    if (ok) {
+        struct list_head *arg = queues > 1 ? &bench_chain : ctx[0].q;
+        set_noallocate_mode(bench_ops[op].noallocate);
+        if (exception_setup(true)) {
+            int64_t before = cpucycles_begin();
+            bench_ops[op].run(arg);
+            int64_t after = cpucycles_end();
+            /* An O(1) operation can take less than the calibrated overhead */
+            *ticks = after - before > cpucycles_overhead
+                         ? after - before - cpucycles_overhead
+                         : 0;
+        } else {
+            ok = false;
+        }
+        exception_cancel();
+        set_noallocate_mode(false);
+    }
+
+    if (bench_removed)
+        q_release_element(bench_removed);
+    for (int i = 0; i < queues; i++)
+        q_free(ctx[i].q);
+    return ok && !error_check();
+}
+
+static bool do_bench(int argc, char *argv[])
+{
+    int n = 0, iters = 100;
+    if (argc != 3 && argc != 4) {
+        report(1, "%s needs 2-3 arguments", argv[0]);
+        return false;
+    }
+
+    int op = -1;
+    for (size_t i = 0; i < sizeof(bench_ops) / sizeof(bench_ops[0]); i++) {
+        if (!strcmp(argv[1], bench_ops[i].name))
+            op = i;
+    }
+    if (op < 0) {
+        report(1, "Unknown operation '%s'", argv[1]);
+        return false;
+    }
+    if (!get_int(argv[2], &n) || n < 0) {
+        report(1, "Invalid queue size '%s'", argv[2]);
+        return false;
+    }
+    if (argc == 4 && (!get_int(argv[3], &iters) || iters < 1)) {
+        report(1, "Invalid number of iterations '%s'", argv[3]);
+        return false;
+    }
+
+    int64_t *ticks = malloc(iters * sizeof(int64_t));
+    if (!ticks) {
+        report(1, "Failed to allocate %d samples", iters);
+        return false;
+    }
+
+    cpucycles_setup();
+    bool ok = true;
+    for (int i = 0; ok && i < iters; i++)
+        ok = bench_once(op, n, &ticks[i]);
+
+    if (ok) {
+        qsort(ticks, iters, sizeof(int64_t), cmp_ticks);
+        int64_t min = ticks[0], p50 = ticks[iters / 2],
+                p99 = ticks[(iters * 99 + 99) / 100 - 1],
+                max = ticks[iters - 1];
+        double ns = p50 * bench_ns_per_tick() / (n ? n : 1);
+        if (bench_csv) {
+            report(1, "op,n,iters,min,p50,p99,max,ns_per_element");
+            report(1, "%s,%d,%d,%ld,%ld,%ld,%ld,%.3f", argv[1], n, iters,
+                   (long) min, (long) p50, (long) p99, (long) max, ns);
+        } else {
+            report(1,
+                   "%s on %d elements, %d runs: min %ld, p50 %ld, p99 %ld, "
+                   "max %ld cycles, %.3f ns/element",
+                   argv[1], n, iters, (long) min, (long) p50, (long) p99,
+                   (long) max, ns);
+        }
+    }
+    free(ticks);
+    return ok;
+}
+
+/* Threads moving elements through the concurrent queue, see do_mpmc() */
+
+/* Most producer or consumer threads of one mpmc run */
+#define MPMC_THREADS_MAX 64
+
+/* Ring size of mpmc unless given */
+#define MPMC_CAPACITY 1024
+
+typedef struct {
+    mpmc_t *q;
+    struct list_head src; /* producer: elements still to insert */
+    struct list_head dst; /* consumer: elements removed, in order */
+    size_t polls;         /* times the queue was found full or empty */
+    pthread_t tid;
+    bool started;
+} mpmc_worker_t;
+
+/* Producers that have not inserted all of their elements yet */
+static atomic_int mpmc_producing;
+
+static void *mpmc_producer(void *arg)
+{
+    mpmc_worker_t *w = arg;
+    element_t *e, *safe;
+
+    /* A consumer relinks @e as soon as it is in, so step past it first */
+    list_for_each_entry_safe (e, safe, &w->src, list) {
+        while (!q_mpmc_enqueue(w->q, e)) {
+            w->polls++;
+            sched_yield();
+        }
+    }
+    INIT_LIST_HEAD(&w->src);
+    atomic_fetch_sub_explicit(&mpmc_producing, 1, memory_order_release);
+    return NULL;
+}
+
+static void *mpmc_consumer(void *arg)
+{
+    mpmc_worker_t *w = arg;
+
+    for (;;) {
+        /* Once every producer is done, finding the queue empty ends it */
+        bool done =
+            !atomic_load_explicit(&mpmc_producing, memory_order_acquire);
+        element_t *e = q_mpmc_dequeue(w->q);
+        if (e) {
+            list_add_tail(&e->list, &w->dst);
+        } else if (done) {
+            break;
+        } else {
+            w->polls++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* Check that each consumer got the elements of each producer in the order
+ * they were inserted, and that @n were moved in total
+ */
+static bool mpmc_verify(mpmc_worker_t *consumers, int nc, int np, int n)
+{
+    int last[MPMC_THREADS_MAX];
+    int total = 0;
+    bool ok = true;
+
+    for (int c = 0; c < nc; c++) {
+        for (int p = 0; p < np; p++)
+            last[p] = -1;
+        element_t *e;
+        list_for_each_entry (e, &consumers[c].dst, list) {
+            int p, seq;
+            if (sscanf(e->value, "%d:%d", &p, &seq) != 2 || p < 0 ||
+                p >= np || seq <= last[p]) {
+                report(1, "ERROR: Consumer %d got '%s' out of order", c,
+                       e->value);
+                ok = false;
+                break;
+            }
+            last[p] = seq;
+            total++;
+        }
+    }
+    if (ok && total != n) {
+        report(1, "ERROR: Moved %d elements, expected %d", total, n);
+        ok = false;
+    }
+    return ok;
+}
+
+static bool do_mpmc(int argc, char *argv[])
+{
+    if (simulation) {
+        if (argc != 1) {
+            report(1, "%s does not need arguments in simulation mode", argv[0]);
+            return false;
+        }
+        bool ok = is_mpmc_insert_tail_const() && is_mpmc_remove_head_const();
+        if (!ok) {
+            report(1,
+                   "ERROR: Probably not constant time or wrong implementation");
+            return false;
+        }
+        report(1, "Probably constant time");
+        return ok;
+    }
+
+    int np, nc, n, capacity = MPMC_CAPACITY;
+    if (argc != 4 && argc != 5) {
+        report(1, "%s needs 3-4 arguments", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &np) || np < 1 || np > MPMC_THREADS_MAX) {
+        report(1, "Invalid number of producers '%s'", argv[1]);
+        return false;
+    }
+    if (!get_int(argv[2], &nc) || nc < 1 || nc > MPMC_THREADS_MAX) {
+        report(1, "Invalid number of consumers '%s'", argv[2]);
+        return false;
+    }
+    if (!get_int(argv[3], &n) || n < 0) {
+        report(1, "Invalid number of elements '%s'", argv[3]);
+        return false;
+    }
+    if (argc == 5 && (!get_int(argv[4], &capacity) || capacity < 1)) {
+        report(1, "Invalid capacity '%s'", argv[4]);
+        return false;
+    }
+
+    mpmc_t *q = q_mpmc_new(capacity);
+    if (!q) {
+        report(1, "ERROR: Could not allocate a queue of %d", capacity);
+        return false;
+    }
+
+    /* Elements are made up front, so that the threads time the queue
+     * rather than the allocator of the harness, which is serialized
+     */
+    mpmc_worker_t producers[MPMC_THREADS_MAX], consumers[MPMC_THREADS_MAX];
+    bool ok = true;
+    for (int p = 0; p < np; p++) {
+        producers[p] = (mpmc_worker_t){.q = q};
+        INIT_LIST_HEAD(&producers[p].src);
+        INIT_LIST_HEAD(&producers[p].dst);
+        char buf[32];
+        for (int i = p; ok && i < n; i += np) {
+            snprintf(buf, sizeof(buf), "%d:%d", p, i / np);
+            element_t *e = q_element_new(buf);
+            ok = e != NULL;
+            if (ok)
+                list_add_tail(&e->list, &producers[p].src);
+        }
+    }
+    if (!ok)
+        report(1, "ERROR: Could not allocate %d elements", n);
+    for (int c = 0; c < nc; c++) {
+        consumers[c] = (mpmc_worker_t){.q = q};
+        INIT_LIST_HEAD(&consumers[c].src);
+        INIT_LIST_HEAD(&consumers[c].dst);
+    }
+
+    int started = 0;
+    int64_t ns = now_ns();
+    atomic_store(&mpmc_producing, np);
+    for (int c = 0; ok && c < nc; c++) {
+        consumers[c].started = !pthread_create(&consumers[c].tid, NULL,
+                                               mpmc_consumer, &consumers[c]);
+        started += consumers[c].started;
+    }
+    if (ok && !started) {
+        report(1, "ERROR: Could not start a consumer thread");
+        ok = false;
+    }
+    /* With a consumer running, a producer that fails to start can be run
+     * here instead without waiting forever on a full queue
+     */
+    for (int p = 0; ok && p < np; p++) {
+        producers[p].started = !pthread_create(&producers[p].tid, NULL,
+                                               mpmc_producer, &producers[p]);
+    }
+    for (int p = 0; ok && p < np; p++) {
+        if (producers[p].started)
+            pthread_join(producers[p].tid, NULL);
+        else
+            mpmc_producer(&producers[p]);
+    }
+    for (int c = 0; c < nc; c++) {
+        if (consumers[c].started)
+            pthread_join(consumers[c].tid, NULL);
+    }
+    ns = now_ns() - ns;
+
+    if (ok)
+        ok = mpmc_verify(consumers, nc, np, n) && !q_mpmc_size(q);
+    if (ok) {
+        size_t full = 0, empty = 0;
+        for (int p = 0; p < np; p++)
+            full += producers[p].polls;
+        for (int c = 0; c < nc; c++)
+            empty += consumers[c].polls;
+        double sec = ns / 1e9;
+        report(1,
+               "%d producers, %d consumers, capacity %d: %d elements in "
+               "%.3f s, %.0f elements/s, %zu retries, %zu full and %zu "
+               "empty polls",
+               np, nc, capacity, n, sec, sec > 0 ? n / sec : 0,
+               q_mpmc_retries(q), full, empty);
+    }
+
+    element_t *e, *safe;
+    for (int p = 0; p < np; p++) {
+        list_for_each_entry_safe (e, safe, &producers[p].src, list)
+            q_release_element(e);
+    }
+    for (int c = 0; c < nc; c++) {
+        list_for_each_entry_safe (e, safe, &consumers[c].dst, list)
+            q_release_element(e);
+    }
+    q_mpmc_free(q);
+    return ok && !error_check();
+}
+
+/* Most commands the unrolled backend runs on the list queue */
+#define BRIDGED_MAX 16
+
+static struct {
+    char *name;
+    cmd_func_t operation;
+    bool chain; /* whether it takes elements from every queue */
+} bridged[BRIDGED_MAX];
+static int bridged_cnt = 0;
+
+/* Lend the elements of @qctx to its list, or pack them back into chunks */
+static bool bridge_queue(queue_contex_t *qctx, bool lend)
+{
+    if (!qctx->q)
+        return true;
+    if (lend) {
+        uq_to_list(uq_of(qctx), qctx->q);
+        return true;
+    }
+    if (uq_from_list(uq_of(qctx), qctx->q))
+        return true;
+    report(1, "ERROR: Could not pack queue %d into chunks", qctx->id);
+    return false;
+}
+
+/* Run a command the unrolled backend does not implement on the list queue.
+ * The current queue lends its elements, or all queues do for commands like
+ * merge that take them from every one, and they are packed back into chunks
+ * afterwards.  Lending keeps the chunks, and the commands never add
+ * elements, so packing back does not allocate.
+ */
+static bool do_bridged(int argc, char *argv[])
+{
+    cmd_func_t operation = NULL;
+    bool whole_chain = false;
+    for (int i = 0; i < bridged_cnt; i++) {
+        if (!strcmp(argv[0], bridged[i].name)) {
+            operation = bridged[i].operation;
+            whole_chain = bridged[i].chain;
+        }
+    }
+    assert(operation);
+
+    queue_contex_t *qctx;
+    if (whole_chain) {
+        list_for_each_entry (qctx, &chain.head, chain)
+            bridge_queue(qctx, true);
+    } else if (current) {
+        bridge_queue(current, true);
+    }
+    lent = true;
+    bool ok = operation(argc, argv);
+    lent = false;
+    if (whole_chain) {
+        list_for_each_entry (qctx, &chain.head, chain)
+            ok = bridge_queue(qctx, false) && ok;
+    } else if (current) {
+        ok = bridge_queue(current, false) && ok;
+    }
+    uq_release_spares();
+    return ok;
+}
+
+/* Add a command that operates on the list queue itself */
+static void add_list_cmd(char *name,
+                         cmd_func_t operation,
+                         char *summary,
+                         char *param,
+                         bool whole_chain)
+{
+    if (unrolled) {
+        assert(bridged_cnt < BRIDGED_MAX);
+        bridged[bridged_cnt].name = name;
+        bridged[bridged_cnt].chain = whole_chain;
+        bridged[bridged_cnt++].operation = operation;
+        operation = do_bridged;
+    }
+    add_cmd(name, operation, summary, param);
+}
+
+#define ADD_LIST_COMMAND(cmd, msg, param) \
+    add_list_cmd(#cmd, do_##cmd, msg, param, false)
+
+/* Same, for a command that works on every queue of the chain */
+#define ADD_CHAIN_COMMAND(cmd, msg, param) \
+    add_list_cmd(#cmd, do_##cmd, msg, param, true)
+
 static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
@@ -962,34 +2482,80 @@ static void console_init()
                 "Insert string str at tail of queue n times. Generate random "
                 "string(s) if str equals RAND. (default: n == 1)",
                 "str [n]");
-    ADD_COMMAND(
-        rh,
-        "Remove from head of queue. Optionally compare to expected value str",
-        "[str]");
-    ADD_COMMAND(
-        rt,
-        "Remove from tail of queue. Optionally compare to expected value str",
-        "[str]");
+    ADD_COMMAND(rh,
+                "Remove from head of queue n times. Compare every removed "
+                "string to str, unless str is omitted or equals RAND. "
+                "(default: n == 1)",
+                "[str [n]]");
+    ADD_COMMAND(rt,
+                "Remove from tail of queue n times. Compare every removed "
+                "string to str, unless str is omitted or equals RAND. "
+                "(default: n == 1)",
+                "[str [n]]");
     ADD_COMMAND(reverse, "Reverse queue", "");
-    ADD_COMMAND(sort, "Sort queue in ascending order", "");
+    ADD_LIST_COMMAND(sort, "Sort queue in ascending order", "");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
-    ADD_COMMAND(dm, "Delete middle node in queue", "");
-    ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
-    ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
-    ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
-    ADD_COMMAND(descend,
-                "Remove every node which has a node with a strictly greater "
-                "value anywhere to the right side of it",
+    ADD_COMMAND(audit, "Report the Shannon entropy of all strings in queue",
                 "");
-    ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
-                "[K]");
+    ADD_COMMAND(save, "Write all queues to a snapshot file", "file");
+    ADD_COMMAND(load, "Append the queues of a snapshot file to the chain",
+                "file");
+    ADD_COMMAND(mem,
+                "Break the memory held by all queues down into element nodes, "
+                "strings and harness overhead",
+                "");
+    ADD_LIST_COMMAND(dm, "Delete middle node in queue", "");
+    ADD_LIST_COMMAND(dedup,
+                     "Delete all nodes that have duplicate string, without "
+                     "requiring sorted input with -u",
+                     "[-u]");
+    ADD_CHAIN_COMMAND(merge, "Merge all the queues into one sorted queue", "");
+    ADD_LIST_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
+    ADD_LIST_COMMAND(descend,
+                     "Remove every node which has a node with a strictly "
+                     "greater value anywhere to the right side of it",
+                     "");
+    ADD_LIST_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
+                     "[K]");
+    ADD_COMMAND(bench,
+                "Time an operation on fresh queues of n random strings, "
+                "reverseK uses K = 3",
+                "op n [iters]");
+    ADD_COMMAND(mpmc,
+                "Move n strings from producer to consumer threads through a "
+                "lock-free queue",
+                "producers consumers n [capacity]");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("arena", &arena_mode, "Carve queue elements out of large slabs",
+              NULL);
+    add_param("dudect_workers", &dudect_workers,
+              "Number of processes measuring in simulation mode", NULL);
+    add_param("timer", &dudect_timer,
+              "Cycle counter for simulation mode and bench (0: architectural, "
+              "1: perf)",
+              NULL);
+    add_param("bench_csv", &bench_csv, "Print bench results as CSV", NULL);
+    add_param("sort_threads", &sort_threads,
+              "Number of threads sort runs on (1: q_sort only)", NULL);
+    add_param("check", &check_policy,
+              "How show validates the queue (0: full, 1: sampled, "
+              "2: incremental)",
+              NULL);
+    add_param("check_period", &check_period,
+              "Shows between full checks when check is not 0 (0: never)",
+              NULL);
+    add_param("footprint", &footprint,
+              "Report the memory use and peak of every command", NULL);
+    add_param("perf", &perf,
+              "Report hardware event counts of every command, per element",
+              perf_set);
+    set_cmd_hooks(command_before, command_after);
 }
 
 /* Signal handlers */
@@ -1022,8 +2588,6 @@ static void q_init()
 static bool q_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
 
     if (exception_setup(true)) {
         struct list_head *cur = chain.head.next;
@@ -1031,14 +2595,15 @@ static bool q_quit(int argc, char *argv[])
             queue_contex_t *qctx, *tmp;
             tmp = qctx = list_entry(cur, queue_contex_t, chain);
             cur = cur->next;
-            q_free(qctx->q);
-            free(tmp);
+            queue_release(tmp);
             chain.size--;
         }
+        /* The after-command hooks may still walk the chain */
+        INIT_LIST_HEAD(&chain.head);
+        current = NULL;
     }
 
     exception_cancel();
-    set_cautious_mode(true);
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -1052,11 +2617,14 @@ static bool q_quit(int argc, char *argv[])
 
 static void usage(char *cmd)
 {
-    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE]\n", cmd);
+    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE][-s SFILE][-u]\n",
+           cmd);
     printf("\t-h         Print this information\n");
     printf("\t-f IFILE   Read commands from IFILE\n");
     printf("\t-v VLEVEL  Set verbosity level\n");
     printf("\t-l LFILE   Echo results to LFILE\n");
+    printf("\t-s SFILE   Write resource usage to SFILE on exit\n");
+    printf("\t-u         Hold queues in unrolled chunks\n");
     exit(0);
 }
 
@@ -1112,6 +2680,33 @@ uintptr_t os_random(uintptr_t seed)
     return x;
 }
 
+/* Record what the run used as "key value" lines, for scripts/driver.py */
+static void write_stats(const char *file_name)
+{
+    FILE *f = fopen(file_name, "w");
+    if (!f) {
+        fprintf(stderr, "Could not open statistics file '%s'\n", file_name);
+        return;
+    }
+    fprintf(f, "peak_bytes %zu\n", peak_bytes_used());
+#if !defined(__APPLE__)
+    /* Unlike getrusage(), the high-water mark of this process image leaves
+     * out the pages of the parent that the child of fork() had mapped
+     */
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[128];
+        unsigned long kb;
+        while (fgets(line, sizeof(line), status)) {
+            if (sscanf(line, "VmHWM: %lu kB", &kb) == 1)
+                fprintf(f, "max_rss_kb %lu\n", kb);
+        }
+        fclose(status);
+    }
+#endif
+    fclose(f);
+}
+
 #define BUFSIZE 256
 int main(int argc, char *argv[])
 {
@@ -1124,10 +2719,11 @@ int main(int argc, char *argv[])
     char *infile_name = NULL;
     char lbuf[BUFSIZE];
     char *logfile_name = NULL;
+    char *statfile_name = NULL;
     int level = 4;
     int c;
 
-    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
+    while ((c = getopt(argc, argv, "hv:f:l:s:u")) != -1) {
         switch (c) {
         case 'h':
             usage(argv[0]);
@@ -1152,6 +2748,12 @@ int main(int argc, char *argv[])
             buf[BUFSIZE - 1] = '\0';
             logfile_name = lbuf;
             break;
+        case 's':
+            statfile_name = optarg;
+            break;
+        case 'u':
+            unrolled = true;
+            break;
         default:
             printf("Unknown option '%c'\n", c);
             usage(argv[0]);
@@ -1191,5 +2793,8 @@ int main(int argc, char *argv[])
     /* Do finish_cmd() before check whether ok is true or false */
     ok = finish_cmd() && ok;
 
+    if (statfile_name)
+        write_stats(statfile_name);
+
     return !ok;
 }
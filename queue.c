@@ -1,6 +1,11 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "queue.h"
 
@@ -11,49 +16,315 @@
  */
 
 
+/* Header of a queue made by q_new(): the list head handed out, followed by
+ * the number of elements linked on it.  Every q_* function that links or
+ * unlinks elements keeps @size exact, so that q_size() needs no walk.
+ */
+typedef struct {
+    struct list_head head;
+    int size;
+} queue_head_t;
+
+/* Element count of the queue at @head */
+static inline int *queue_size(struct list_head *head)
+{
+    return &container_of(head, queue_head_t, head)->size;
+}
+
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    return NULL;
+    queue_head_t *q = malloc(sizeof(queue_head_t));
+    if (!q)
+        return NULL;
+
+    INIT_LIST_HEAD(&q->head);
+    q->size = 0;
+    return &q->head;
 }
 
 /* Free all storage used by queue */
-void q_free(struct list_head *l) {}
+void q_free(struct list_head *l)
+{
+    if (!l)
+        return;
+
+    element_t *entry, *safe;
+    list_for_each_entry_safe (entry, safe, l, list)
+        q_release_element(entry);
+    free(container_of(l, queue_head_t, head));
+}
+
+/* Hash the string of @e a word at a time, starting from the cached prefix */
+static uint32_t element_hash(const element_t *e)
+{
+    uint64_t h = e->prefix ^ (e->len * 0x9e3779b97f4a7c15ULL);
+    for (size_t i = ELEMENT_PREFIX; i < e->len; i += sizeof(uint64_t)) {
+        uint64_t w = 0;
+        size_t n = e->len - i < sizeof(w) ? e->len - i : sizeof(w);
+        memcpy(&w, e->value + i, n);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    /* finalizer of MurmurHash3 */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t) h;
+}
+
+/* Allocate an unlinked element holding a private copy of @s.
+ * The string is stored inline right after the element, so each insertion
+ * costs one allocation, and in arena mode one carve out of a slab.
+ */
+element_t *q_element_new(const char *s)
+{
+    size_t len = strlen(s);
+    if (len > UINT32_MAX)
+        return NULL;
+    element_t *e = malloc(sizeof(element_t) + len + 1);
+    if (!e)
+        return NULL;
+
+    e->value = memcpy(e + 1, s, len + 1);
+    e->len = len;
+    e->prefix = 0;
+    for (size_t i = 0; i < ELEMENT_PREFIX; i++)
+        e->prefix = (e->prefix << 8) | (i < len ? (unsigned char) s[i] : 0);
+    e->hash = 0;
+    return e;
+}
+
+/* Hash of the string of @e, computed on first use and cached in @e->hash */
+static uint32_t element_hash_of(element_t *e)
+{
+    if (!e->hash) {
+        uint32_t h = element_hash(e);
+        e->hash = h ? h : 1; /* 0 marks a hash not computed yet */
+    }
+    return e->hash;
+}
+
+/* Whether two elements hold the same string */
+static inline bool element_eq(const element_t *a, const element_t *b)
+{
+    /* Hashes only tell strings apart once both are computed */
+    if ((a->hash && b->hash && a->hash != b->hash) || a->prefix != b->prefix ||
+        a->len != b->len)
+        return false;
+    return a->len <= ELEMENT_PREFIX ||
+           !memcmp(a->value + ELEMENT_PREFIX, b->value + ELEMENT_PREFIX,
+                   a->len - ELEMENT_PREFIX);
+}
 
 /* Insert an element at head of queue */
 bool q_insert_head(struct list_head *head, char *s)
 {
+    if (!head || !s)
+        return false;
+
+    element_t *e = q_element_new(s);
+    if (!e)
+        return false;
+
+    list_add(&e->list, head);
+    (*queue_size(head))++;
     return true;
 }
 
 /* Insert an element at tail of queue */
 bool q_insert_tail(struct list_head *head, char *s)
 {
+    if (!head || !s)
+        return false;
+
+    element_t *e = q_element_new(s);
+    if (!e)
+        return false;
+
+    list_add_tail(&e->list, head);
+    (*queue_size(head))++;
     return true;
 }
 
+/* Link an existing element at tail of queue */
+void q_link_tail(struct list_head *head, element_t *e)
+{
+    list_add_tail(&e->list, head);
+    (*queue_size(head))++;
+}
+
+/* Copy the string of @e to @sp (at most @bufsize - 1 characters) */
+element_t *q_element_copy(element_t *e, char *sp, size_t bufsize)
+{
+    if (sp && bufsize) {
+        size_t len = e->len < bufsize - 1 ? e->len : bufsize - 1;
+        memcpy(sp, e->value, len);
+        sp[len] = '\0';
+    }
+    return e;
+}
+
+/* Unlink @node and copy its string to @sp (at most @bufsize - 1 characters) */
+static element_t *element_remove(struct list_head *node,
+                                 char *sp,
+                                 size_t bufsize)
+{
+    list_del_init(node);
+    return q_element_copy(list_entry(node, element_t, list), sp, bufsize);
+}
+
 /* Remove an element from head of queue */
 element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
 {
-    return NULL;
+    if (!head || list_empty(head))
+        return NULL;
+
+    (*queue_size(head))--;
+    return element_remove(head->next, sp, bufsize);
 }
 
 /* Remove an element from tail of queue */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
 {
-    return NULL;
+    if (!head || list_empty(head))
+        return NULL;
+
+    (*queue_size(head))--;
+    return element_remove(head->prev, sp, bufsize);
+}
+
+/* Chain up the elements for @n strings from @gen on the empty list @chain,
+ * so the queue is touched only once, by the splice that follows
+ */
+static size_t element_chain(struct list_head *chain,
+                            bool at_head,
+                            q_gen_t gen,
+                            void *arg,
+                            size_t n)
+{
+    size_t cnt = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        const char *s = gen(arg, i);
+        element_t *e = s ? q_element_new(s) : NULL;
+        if (!e)
+            continue;
+        if (at_head)
+            list_add(&e->list, chain);
+        else
+            list_add_tail(&e->list, chain);
+        cnt++;
+    }
+    return cnt;
+}
+
+/* Insert @n elements at head of queue */
+size_t q_insert_head_bulk(struct list_head *head,
+                          q_gen_t gen,
+                          void *arg,
+                          size_t n)
+{
+    if (!head || !gen)
+        return 0;
+
+    LIST_HEAD(chain);
+    size_t cnt = element_chain(&chain, true, gen, arg, n);
+    list_splice(&chain, head);
+    *queue_size(head) += cnt;
+    return cnt;
+}
+
+/* Insert @n elements at tail of queue */
+size_t q_insert_tail_bulk(struct list_head *head,
+                          q_gen_t gen,
+                          void *arg,
+                          size_t n)
+{
+    if (!head || !gen)
+        return 0;
+
+    LIST_HEAD(chain);
+    size_t cnt = element_chain(&chain, false, gen, arg, n);
+    list_splice_tail(&chain, head);
+    *queue_size(head) += cnt;
+    return cnt;
+}
+
+/* Remove up to @n elements from head of queue */
+size_t q_remove_head_bulk(struct list_head *head,
+                          struct list_head *chain,
+                          size_t n)
+{
+    if (!head || !chain || list_empty(head) || !n)
+        return 0;
+
+    size_t cnt = 1;
+    struct list_head *last = head->next;
+    for (; cnt < n && last->next != head; cnt++)
+        last = last->next;
+    list_cut_position(chain, head, last);
+    *queue_size(head) -= cnt;
+    return cnt;
+}
+
+/* Remove up to @n elements from tail of queue */
+size_t q_remove_tail_bulk(struct list_head *head,
+                          struct list_head *chain,
+                          size_t n)
+{
+    if (!head || !chain || list_empty(head) || !n)
+        return 0;
+
+    size_t cnt = 1;
+    struct list_head *first = head->prev;
+    for (; cnt < n && first->prev != head; cnt++)
+        first = first->prev;
+
+    /* Cut off the elements that stay, hand the rest over, and put the
+     * ones that stay back
+     */
+    LIST_HEAD(keep);
+    list_cut_position(&keep, head, first->prev);
+    list_splice_init(head, chain);
+    list_splice(&keep, head);
+    *queue_size(head) -= cnt;
+    return cnt;
 }
 
 /* Return number of elements in queue */
 int q_size(struct list_head *head)
 {
-    return -1;
+    return head ? *queue_size(head) : 0;
 }
 
 /* Delete the middle node in queue */
 bool q_delete_mid(struct list_head *head)
 {
     // https://leetcode.com/problems/delete-the-middle-node-of-a-linked-list/
+    if (!head || list_empty(head))
+        return false;
+
+    /* Reach the node at index ⌊n / 2⌋ from whichever end is nearer, which
+     * touches at most n / 2 nodes rather than all of them
+     */
+    int n = *queue_size(head), mid = n / 2;
+    struct list_head *node;
+    if (mid <= n - 1 - mid) {
+        node = head->next;
+        for (int i = 0; i < mid; i++)
+            node = node->next;
+    } else {
+        node = head->prev;
+        for (int i = n - 1; i > mid; i--)
+            node = node->prev;
+    }
+
+    list_del(node);
+    q_release_element(list_entry(node, element_t, list));
+    (*queue_size(head))--;
     return true;
 }
 
@@ -61,6 +332,80 @@ bool q_delete_mid(struct list_head *head)
 bool q_delete_dup(struct list_head *head)
 {
     // https://leetcode.com/problems/remove-duplicates-from-sorted-list-ii/
+    if (!head)
+        return false;
+
+    element_t *entry, *safe;
+    bool dup = false;
+    list_for_each_entry_safe (entry, safe, head, list) {
+        bool next_dup = &safe->list != head && element_eq(entry, safe);
+        if (dup || next_dup) {
+            list_del(&entry->list);
+            q_release_element(entry);
+            (*queue_size(head))--;
+        }
+        dup = next_dup;
+    }
+    return true;
+}
+
+/* Slot of the open-addressing hash set used by q_delete_dup_unsorted() */
+typedef struct {
+    element_t *e; /* first element holding the string, NULL if free */
+    uint32_t hash;
+    bool dup; /* another element holding the string was seen */
+} dedup_slot_t;
+
+/* Delete all nodes that have duplicate string, in any order */
+bool q_delete_dup_unsorted(struct list_head *head)
+{
+    if (!head)
+        return false;
+
+    size_t n = q_size(head);
+    if (n < 2)
+        return true;
+
+    /* Keep the load factor at or below one half */
+    size_t cap = 4;
+    while (cap < 2 * n)
+        cap <<= 1;
+    dedup_slot_t *set = malloc(cap * sizeof(dedup_slot_t));
+    if (!set)
+        return false;
+    memset(set, 0, cap * sizeof(dedup_slot_t));
+
+    /* The first element of each duplicated string waits here, since its slot
+     * still compares against the string
+     */
+    LIST_HEAD(firsts);
+    element_t *entry, *safe;
+    list_for_each_entry_safe (entry, safe, head, list) {
+        uint32_t h = element_hash_of(entry);
+        size_t i = h & (cap - 1);
+        while (set[i].e && (set[i].hash != h || !element_eq(set[i].e, entry)))
+            i = (i + 1) & (cap - 1);
+
+        if (!set[i].e) {
+            set[i].e = entry;
+            set[i].hash = h;
+            continue;
+        }
+        if (!set[i].dup) {
+            list_move(&set[i].e->list, &firsts);
+            set[i].dup = true;
+        }
+        list_del(&entry->list);
+        q_release_element(entry);
+        n--;
+    }
+
+    list_for_each_entry_safe (entry, safe, &firsts, list) {
+        q_release_element(entry);
+        n--;
+    }
+    *queue_size(head) = n;
+    free(set);
     return true;
 }
 
@@ -68,31 +413,641 @@ bool q_delete_dup(struct list_head *head)
 void q_swap(struct list_head *head)
 {
     // https://leetcode.com/problems/swap-nodes-in-pairs/
+    q_reverseK(head, 2);
 }
 
 /* Reverse elements in queue */
-void q_reverse(struct list_head *head) {}
+void q_reverse(struct list_head *head)
+{
+    if (!head)
+        return;
+
+    struct list_head *node = head;
+    do {
+        struct list_head *next = node->next;
+        node->next = node->prev;
+        node->prev = next;
+        node = next;
+    } while (node != head);
+}
 
 /* Reverse the nodes of the list k at a time */
 void q_reverseK(struct list_head *head, int k)
 {
     // https://leetcode.com/problems/reverse-nodes-in-k-group/
+    if (!head || k < 2)
+        return;
+
+    struct list_head *anchor = head;
+    for (;;) {
+        /* Make sure a full group of k nodes follows @anchor */
+        struct list_head *node = anchor->next;
+        int cnt = 0;
+        while (cnt < k && node != head) {
+            node = node->next;
+            cnt++;
+        }
+        if (cnt < k)
+            return;
+
+        /* Moving each node to the front of the group reverses it */
+        struct list_head *first = anchor->next;
+        for (int i = 1; i < k; i++)
+            list_move(first->next, anchor);
+        anchor = first;
+    }
+}
+
+/* Compare the strings held by two list nodes */
+static inline int node_cmp(const struct list_head *a, const struct list_head *b)
+{
+    return q_element_cmp(list_entry(a, element_t, list),
+                         list_entry(b, element_t, list));
+}
+
+/* Merge two null-terminated runs linked through ->next.
+ * Elements of @a win ties, which keeps the sort stable.
+ */
+static struct list_head *merge(struct list_head *a, struct list_head *b)
+{
+    struct list_head *head = NULL, **tail = &head;
+
+    for (;;) {
+        if (node_cmp(a, b) <= 0) {
+            *tail = a;
+            tail = &a->next;
+            a = a->next;
+            if (!a) {
+                *tail = b;
+                break;
+            }
+        } else {
+            *tail = b;
+            tail = &b->next;
+            b = b->next;
+            if (!b) {
+                *tail = a;
+                break;
+            }
+        }
+    }
+    return head;
 }
 
+/* Like merge(), but also restore the ->prev links and the circular structure
+ * of @head.  This is the only pass over the list that touches ->prev.
+ */
+static void merge_final(struct list_head *head,
+                        struct list_head *a,
+                        struct list_head *b)
+{
+    struct list_head *tail = head;
+
+    for (;;) {
+        if (node_cmp(a, b) <= 0) {
+            tail->next = a;
+            a->prev = tail;
+            tail = a;
+            a = a->next;
+            if (!a)
+                break;
+        } else {
+            tail->next = b;
+            b->prev = tail;
+            tail = b;
+            b = b->next;
+            if (!b) {
+                b = a;
+                break;
+            }
+        }
+    }
+
+    /* Finish linking the remainder of the list */
+    tail->next = b;
+    do {
+        b->prev = tail;
+        tail = b;
+        b = b->next;
+    } while (b);
+
+    tail->next = head;
+    head->prev = tail;
+}
+
+/* Detach the longest run starting at *@list and advance *@list past it.
+ * A non-decreasing run is taken as is; a strictly decreasing one is reversed
+ * in place, so equal elements never swap their relative order.
+ * Return the run as a null-terminated list and store its length in @len.
+ */
+static struct list_head *find_run(struct list_head **list, size_t *len)
+{
+    struct list_head *run = *list, *next = run->next;
+    size_t n = 1;
+
+    if (next && node_cmp(run, next) > 0) {
+        /* Descending: push each node onto the front of the run */
+        run->next = NULL;
+        do {
+            struct list_head *after = next->next;
+            next->next = run;
+            run = next;
+            next = after;
+            n++;
+        } while (next && node_cmp(run, next) > 0);
+    } else {
+        struct list_head *tail = run;
+        while (next && node_cmp(tail, next) <= 0) {
+            tail = next;
+            next = next->next;
+            n++;
+        }
+        tail->next = NULL;
+    }
+
+    *list = next;
+    *len = n;
+    return run;
+}
+
+/* Upper bound on the number of pending runs. Each pending run is at least
+ * twice as long as the one pushed after it, so the depth never exceeds the
+ * number of bits in size_t.
+ */
+#define MAX_PENDING (sizeof(size_t) * 8)
+
+/* Set when the time limit goes off during q_sort_parallel(), to make its
+ * workers give up.  A q_sort() that gives up leaves the list as broken as
+ * one unwound by the time limit does.
+ */
+static atomic_bool sort_cancelled;
+
 /* Sort elements of queue in ascending order */
-void q_sort(struct list_head *head) {}
+void q_sort(struct list_head *head)
+{
+    /* Bottom-up natural merge sort in the spirit of lib/list_sort.c of the
+     * Linux kernel.  The list is treated as singly linked while sorting.
+     * Runs already present in the input are detected and pushed onto a
+     * stack of pending runs: each run is null-terminated through ->next,
+     * and the runs themselves are chained from newest to oldest through the
+     * ->prev pointer of their first node.  Adjacent pending runs are merged
+     * whenever the older one is less than twice as long as the newer one.
+     * No memory is allocated, and ->prev is repaired once by merge_final().
+     */
+    if (!head || list_empty(head) || list_is_singular(head))
+        return;
+
+    struct list_head *list = head->next, *pending = NULL;
+    size_t len[MAX_PENDING];
+    int depth = 0;
+
+    /* Convert to a null-terminated singly-linked list */
+    head->prev->next = NULL;
+
+    do {
+        size_t n;
+        struct list_head *run = find_run(&list, &n);
+
+        if (atomic_load_explicit(&sort_cancelled, memory_order_relaxed))
+            return;
+
+        run->prev = pending;
+        pending = run;
+        len[depth++] = n;
+
+        while (depth > 1 && len[depth - 2] < 2 * len[depth - 1]) {
+            struct list_head *b = pending, *a = b->prev;
+            struct list_head *older = a->prev;
+            a = merge(a, b);
+            a->prev = older;
+            pending = a;
+            len[depth - 2] += len[depth - 1];
+            depth--;
+        }
+    } while (list);
+
+    /* Collapse what is left, newest runs first */
+    list = pending;
+    pending = pending->prev;
+    while (pending && pending->prev) {
+        struct list_head *older = pending->prev;
+        list = merge(pending, list);
+        pending = older;
+    }
+
+    if (!pending) {
+        /* The whole input was a single run: only relink ->prev */
+        struct list_head *tail = head;
+        for (; list; list = list->next) {
+            tail->next = list;
+            list->prev = tail;
+            tail = list;
+        }
+        tail->next = head;
+        head->prev = tail;
+        return;
+    }
+
+    merge_final(head, pending, list);
+}
 
 /* Remove every node which has a node with a strictly greater value anywhere to
  * the right side of it */
 int q_descend(struct list_head *head)
 {
     // https://leetcode.com/problems/remove-nodes-from-linked-list/
-    return 0;
+    if (!head || list_empty(head))
+        return 0;
+
+    /* Scan from the tail, keeping only running maxima */
+    int cnt = 1;
+    struct list_head *max = head->prev, *node = max->prev;
+    while (node != head) {
+        struct list_head *prev = node->prev;
+        if (node_cmp(node, max) < 0) {
+            list_del(node);
+            q_release_element(list_entry(node, element_t, list));
+        } else {
+            max = node;
+            cnt++;
+        }
+        node = prev;
+    }
+    *queue_size(head) = cnt;
+    return cnt;
+}
+
+/* Maximum number of queues combined by a single heap pass of q_merge().
+ * The heap lives on the stack since q_merge() must not allocate; longer
+ * chains are folded into the first queue MERGE_WAYS - 1 queues at a time.
+ */
+#define MERGE_WAYS 256
+
+/* A queue taking part in q_merge(), keyed on its current head string */
+typedef struct {
+    struct list_head *q;
+    int order; /* position in the chain, breaks ties to keep merge stable */
+} merge_src_t;
+
+static inline bool src_less(const merge_src_t *a, const merge_src_t *b)
+{
+    int cmp = node_cmp(a->q->next, b->q->next);
+    return cmp < 0 || (cmp == 0 && a->order < b->order);
+}
+
+/* Restore the min-heap property downwards from index @i */
+static void heap_sift_down(merge_src_t *heap, int n, int i)
+{
+    merge_src_t src = heap[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && src_less(&heap[child + 1], &heap[child]))
+            child++;
+        if (!src_less(&heap[child], &src))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = src;
+}
+
+/* Merge the @n non-empty sorted queues in @heap into the empty queue @dst.
+ * Nodes are relinked with list_move_tail(); no element is copied.
+ */
+static void merge_pass(struct list_head *dst, merge_src_t *heap, int n)
+{
+    LIST_HEAD(out);
+
+    for (int i = n / 2 - 1; i >= 0; i--)
+        heap_sift_down(heap, n, i);
+
+    while (n > 1) {
+        struct list_head *q = heap[0].q;
+        list_move_tail(q->next, &out);
+        if (list_empty(q))
+            heap[0] = heap[--n];
+        heap_sift_down(heap, n, 0);
+    }
+
+    /* The last queue standing is appended as a whole */
+    if (n)
+        list_splice_tail_init(heap[0].q, &out);
+    list_splice(&out, dst);
 }
 
 /* Merge all the queues into one sorted queue, which is in ascending order */
 int q_merge(struct list_head *head)
 {
     // https://leetcode.com/problems/merge-k-sorted-lists/
-    return 0;
+    if (!head || list_empty(head))
+        return 0;
+
+    queue_contex_t *first = list_first_entry(head, queue_contex_t, chain);
+    if (!first->q)
+        return 0;
+
+    /* k-way merge driven by a binary min-heap: O(n log k) comparisons.
+     * Empty queues never enter the heap, and the element count is taken
+     * from the count each queue keeps rather than by walking the queues.
+     */
+    int total = q_size(first->q);
+    struct list_head *pos = first->chain.next;
+    do {
+        merge_src_t heap[MERGE_WAYS];
+        int n = 0;
+
+        if (!list_empty(first->q))
+            heap[n++] = (merge_src_t){.q = first->q, .order = 0};
+        for (; pos != head && n < MERGE_WAYS; pos = pos->next) {
+            queue_contex_t *ctx = list_entry(pos, queue_contex_t, chain);
+            if (!ctx->q || list_empty(ctx->q))
+                continue;
+            heap[n] = (merge_src_t){.q = ctx->q, .order = n};
+            n++;
+            total += q_size(ctx->q);
+            *queue_size(ctx->q) = 0;
+            ctx->size = 0;
+        }
+        merge_pass(first->q, heap, n);
+    } while (pos != head);
+
+    *queue_size(first->q) = total;
+    first->size = total;
+    return total;
+}
+
+/* Fewest elements handed to each thread of q_sort_parallel() */
+#define SORT_PART_MIN (1 << 14)
+
+/* Most threads q_sort_parallel() sorts on */
+#define SORT_THREADS_MAX 64
+
+/* Workers of the q_sort_parallel() in progress, and how many are done */
+static pthread_t sort_tid[SORT_THREADS_MAX];
+static bool sort_started[SORT_THREADS_MAX];
+static int sort_nthreads;
+static atomic_int sort_done;
+
+/* SIGALRM action that q_sort_parallel() replaced */
+static struct sigaction sort_saved_alarm;
+
+static void *sort_worker(void *head)
+{
+    q_sort(head);
+    atomic_fetch_add(&sort_done, 1);
+    return NULL;
+}
+
+/* Time limit during q_sort_parallel().  The harness unwinds the caller from
+ * its SIGALRM handler, and the parts of the queue live on the stack it
+ * unwinds, so stop and join the workers before handing the alarm on.
+ */
+static void sort_alarm(int sig)
+{
+    atomic_store(&sort_cancelled, true);
+    for (int i = 1; i < sort_nthreads; i++) {
+        if (sort_started[i])
+            pthread_join(sort_tid[i], NULL);
+    }
+    sort_nthreads = 0;
+
+    sigaction(SIGALRM, &sort_saved_alarm, NULL);
+    if (sort_saved_alarm.sa_handler == SIG_DFL)
+        raise(sig);
+    else if (sort_saved_alarm.sa_handler != SIG_IGN)
+        sort_saved_alarm.sa_handler(sig);
+}
+
+/* Sort elements of queue in ascending order on several threads */
+void q_sort_parallel(struct list_head *head, int nthreads)
+{
+    if (!head)
+        return;
+
+    size_t n = nthreads > 1 ? (size_t) q_size(head) : 0;
+    if (nthreads > SORT_THREADS_MAX)
+        nthreads = SORT_THREADS_MAX;
+    if (n / SORT_PART_MIN < (size_t) nthreads)
+        nthreads = n / SORT_PART_MIN;
+    if (nthreads < 2) {
+        q_sort(head);
+        return;
+    }
+
+    /* Cut the queue into parts, the last one taking the remainder */
+    struct list_head parts[SORT_THREADS_MAX];
+    for (int i = 0; i < nthreads - 1; i++) {
+        struct list_head *node = head;
+        for (size_t k = n / nthreads; k; k--)
+            node = node->next;
+        list_cut_position(&parts[i], head, node);
+    }
+    INIT_LIST_HEAD(&parts[nthreads - 1]);
+    list_splice_init(head, &parts[nthreads - 1]);
+
+    /* The time limit still stops the caller, but through sort_alarm(),
+     * which first stops and joins the workers.  Only the caller takes
+     * SIGALRM: the workers inherit it blocked.
+     */
+    struct sigaction act = {.sa_handler = sort_alarm};
+    sigemptyset(&act.sa_mask);
+    sigset_t alarm_set, saved;
+    sigemptyset(&alarm_set);
+    sigaddset(&alarm_set, SIGALRM);
+
+    atomic_store(&sort_cancelled, false);
+    atomic_store(&sort_done, 0);
+    pthread_sigmask(SIG_BLOCK, &alarm_set, &saved);
+    sigaction(SIGALRM, &act, &sort_saved_alarm);
+    int started = 0;
+    for (int i = 1; i < nthreads; i++) {
+        sort_started[i] =
+            !pthread_create(&sort_tid[i], NULL, sort_worker, &parts[i]);
+        started += sort_started[i];
+    }
+    sort_nthreads = nthreads;
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    q_sort(&parts[0]);
+    for (int i = 1; i < nthreads; i++) {
+        if (!sort_started[i])
+            q_sort(&parts[i]);
+    }
+    /* Wait without pthread_join(), which sort_alarm() must not interrupt */
+    while (atomic_load(&sort_done) < started)
+        nanosleep(&(struct timespec){.tv_nsec = 100000}, NULL);
+
+    pthread_sigmask(SIG_BLOCK, &alarm_set, &saved);
+    sigaction(SIGALRM, &sort_saved_alarm, NULL);
+    for (int i = 1; i < nthreads; i++) {
+        if (sort_started[i])
+            pthread_join(sort_tid[i], NULL);
+    }
+    sort_nthreads = 0;
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    /* Parts keep their original order as merge ranks, so ties stay stable */
+    merge_src_t heap[SORT_THREADS_MAX];
+    for (int i = 0; i < nthreads; i++)
+        heap[i] = (merge_src_t){.q = &parts[i], .order = i};
+    merge_pass(head, heap, nthreads);
+}
+
+/* Size of a cache line, which the two ends of mpmc_t are kept apart by */
+#define MPMC_LINE 64
+
+/* Slot @i of the ring is free for the insertion at position p when its
+ * sequence number is p, and holds the element for the removal at position p
+ * once it is p + 1.  Removing sets it to p + capacity for the next lap.
+ */
+typedef struct {
+    atomic_size_t seq;
+    element_t *e;
+} mpmc_cell_t;
+
+struct mpmc {
+    atomic_size_t tail; /* next insertion position */
+    char tail_pad[MPMC_LINE - sizeof(atomic_size_t)];
+    atomic_size_t head; /* next removal position */
+    char head_pad[MPMC_LINE - sizeof(atomic_size_t)];
+    atomic_size_t retries;
+    size_t mask;
+    mpmc_cell_t cells[];
+};
+
+/* Create an empty concurrent queue */
+mpmc_t *q_mpmc_new(size_t capacity)
+{
+    size_t cap = 2;
+    while (cap < capacity && cap <= SIZE_MAX / 2 / sizeof(mpmc_cell_t))
+        cap <<= 1;
+    if (cap < capacity)
+        return NULL;
+
+    mpmc_t *q = malloc(sizeof(mpmc_t) + cap * sizeof(mpmc_cell_t));
+    if (!q)
+        return NULL;
+
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    atomic_init(&q->retries, 0);
+    q->mask = cap - 1;
+    for (size_t i = 0; i < cap; i++) {
+        atomic_init(&q->cells[i].seq, i);
+        q->cells[i].e = NULL;
+    }
+    return q;
+}
+
+/* Free the concurrent queue and the elements left in it */
+void q_mpmc_free(mpmc_t *q)
+{
+    if (!q)
+        return;
+
+    element_t *e;
+    while ((e = q_mpmc_dequeue(q)))
+        q_release_element(e);
+    free(q);
+}
+
+/* Append @e at the tail of the concurrent queue */
+bool q_mpmc_enqueue(mpmc_t *q, element_t *e)
+{
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    mpmc_cell_t *cell;
+
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->tail, &pos, pos + 1, memory_order_relaxed,
+                    memory_order_relaxed))
+                break;
+            atomic_fetch_add_explicit(&q->retries, 1, memory_order_relaxed);
+        } else if (diff < 0) {
+            /* The slot still holds the element from the previous lap */
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+
+    cell->e = e;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+/* Take the element at the head of the concurrent queue */
+element_t *q_mpmc_dequeue(mpmc_t *q)
+{
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    mpmc_cell_t *cell;
+
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->head, &pos, pos + 1, memory_order_relaxed,
+                    memory_order_relaxed))
+                break;
+            atomic_fetch_add_explicit(&q->retries, 1, memory_order_relaxed);
+        } else if (diff < 0) {
+            /* Nothing was inserted at this position yet */
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+
+    element_t *e = cell->e;
+    atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+    return e;
+}
+
+/* Insert an element at tail of the concurrent queue */
+bool q_mpmc_insert_tail(mpmc_t *q, char *s)
+{
+    if (!q || !s)
+        return false;
+
+    element_t *e = q_element_new(s);
+    if (!e)
+        return false;
+
+    if (!q_mpmc_enqueue(q, e)) {
+        q_release_element(e);
+        return false;
+    }
+    return true;
+}
+
+/* Remove an element from head of the concurrent queue */
+element_t *q_mpmc_remove_head(mpmc_t *q, char *sp, size_t bufsize)
+{
+    element_t *e = q ? q_mpmc_dequeue(q) : NULL;
+    return e ? q_element_copy(e, sp, bufsize) : NULL;
+}
+
+/* Number of elements in the concurrent queue */
+size_t q_mpmc_size(mpmc_t *q)
+{
+    if (!q)
+        return 0;
+
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    return tail - head;
+}
+
+/* Number of compare-and-swaps lost on the concurrent queue */
+size_t q_mpmc_retries(mpmc_t *q)
+{
+    return q ? atomic_load_explicit(&q->retries, memory_order_relaxed) : 0;
 }
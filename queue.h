@@ -9,22 +9,63 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "harness.h"
 #include "list.h"
 
+/* Number of leading bytes of the string cached in element_t */
+#define ELEMENT_PREFIX sizeof(uint64_t)
+
 /**
  * element_t - Linked list element
  * @value: pointer to array holding string
  * @list: node of a doubly-linked list
+ * @prefix: first ELEMENT_PREFIX bytes of @value, packed big-endian and padded
+ *          with zeros, so that comparing prefixes agrees with strcmp()
+ * @len: length of @value, not counting the terminating null byte
+ * @hash: hash of @value, so that most unequal strings are told apart without
+ *        reading them, or 0 until an operation first needs it
  *
- * @value needs to be explicitly allocated and freed
+ * @value needs to be explicitly allocated and freed, unless it points to
+ * storage placed right after the element in the same allocation.
+ * @prefix, @len and @hash must be kept in sync with @value.  Strings are
+ * limited to 4 GiB, so that @len and @hash fit in one word.
  */
 typedef struct {
     char *value;
     struct list_head list;
+    uint64_t prefix;
+    uint32_t len;
+    uint32_t hash;
 } element_t;
 
+/**
+ * q_element_cmp() - Compare the strings of two elements like strcmp()
+ * @a: first element
+ * @b: second element
+ *
+ * Most comparisons are decided by @prefix alone, without touching the
+ * strings themselves.  The rest compare a known number of bytes, up to and
+ * including the terminating null byte of the shorter string.
+ *
+ * Return: negative, zero or positive as @a is less than, equal to or greater
+ * than @b
+ */
+static inline int q_element_cmp(const element_t *a, const element_t *b)
+{
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+
+    /* Equal prefixes holding a null byte mean equal strings */
+    if (a->len < ELEMENT_PREFIX)
+        return 0;
+    size_t len = a->len < b->len ? a->len : b->len;
+    return memcmp(a->value + ELEMENT_PREFIX, b->value + ELEMENT_PREFIX,
+                  len + 1 - ELEMENT_PREFIX);
+}
+
 /**
  * queue_contex_t - The context managing a chain of queues
  * @q: pointer to the head of the queue
@@ -44,6 +85,11 @@ typedef struct {
 /**
  * q_new() - Create an empty queue whose next and prev pointer point to itself
  *
+ * The header is followed by the number of elements in the queue, which the
+ * q_* functions keep up to date.  Headers handed to them must come from
+ * q_new(), and elements must be linked on or unlinked from a queue with the
+ * q_* functions only.
+ *
  * Return: NULL for allocation failed
  */
 struct list_head *q_new();
@@ -54,6 +100,37 @@ struct list_head *q_new();
  */
 void q_free(struct list_head *head);
 
+/**
+ * q_element_new() - Allocate an element holding a copy of @s
+ * @s: string to be copied
+ *
+ * The element is not linked on any queue.  It is released with
+ * q_release_element(), or handed to a queue with q_link_tail().
+ *
+ * Return: NULL for allocation failed
+ */
+element_t *q_element_new(const char *s);
+
+/**
+ * q_link_tail() - Link an existing element at the tail
+ * @head: header of queue
+ * @e: element not linked on any queue
+ */
+void q_link_tail(struct list_head *head, element_t *e);
+
+/**
+ * q_element_copy() - Copy the string of a removed element
+ * @e: element just taken off its queue
+ * @sp: buffer to copy the string to, or NULL
+ * @bufsize: size of @sp
+ *
+ * Copies at most @bufsize - 1 characters, as q_remove_head() does, so that
+ * every queue hands out removed strings the same way.
+ *
+ * Return: @e
+ */
+element_t *q_element_copy(element_t *e, char *sp, size_t bufsize);
+
 /**
  * q_insert_head() - Insert an element in the head
  * @head: header of queue
@@ -108,6 +185,82 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize);
  */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
 
+/**
+ * q_gen_t - Supplier of the strings for a bulk insertion
+ * @arg: argument passed through from the bulk insertion
+ * @i: index of the string, counting from 0
+ *
+ * The returned string is copied before the next call, so it may live in a
+ * buffer that later calls overwrite.
+ *
+ * Return: the @i-th string to insert
+ */
+typedef const char *(*q_gen_t)(void *arg, size_t i);
+
+/**
+ * q_insert_head_bulk() - Insert @n elements at the head
+ * @head: header of queue
+ * @gen: supplier of the strings to insert
+ * @arg: argument passed to @gen
+ * @n: number of elements to insert
+ *
+ * The queue ends up as if q_insert_head() had been called with each string
+ * in turn, but the elements are chained up on their own and spliced into
+ * the queue at once.  Strings whose element cannot be allocated are skipped.
+ *
+ * Return: number of elements inserted
+ */
+size_t q_insert_head_bulk(struct list_head *head,
+                          q_gen_t gen,
+                          void *arg,
+                          size_t n);
+
+/**
+ * q_insert_tail_bulk() - Insert @n elements at the tail
+ * @head: header of queue
+ * @gen: supplier of the strings to insert
+ * @arg: argument passed to @gen
+ * @n: number of elements to insert
+ *
+ * Like q_insert_head_bulk(), as if q_insert_tail() had been called with each
+ * string in turn.
+ *
+ * Return: number of elements inserted
+ */
+size_t q_insert_tail_bulk(struct list_head *head,
+                          q_gen_t gen,
+                          void *arg,
+                          size_t n);
+
+/**
+ * q_remove_head_bulk() - Remove up to @n elements from the head
+ * @head: header of queue
+ * @chain: empty list receiving the removed elements, in queue order
+ * @n: number of elements to remove
+ *
+ * As with q_remove_head(), the elements are only unlinked.  The caller
+ * releases them, along with their strings.
+ *
+ * Return: number of elements moved to @chain, fewer than @n if the queue
+ * ran out
+ */
+size_t q_remove_head_bulk(struct list_head *head,
+                          struct list_head *chain,
+                          size_t n);
+
+/**
+ * q_remove_tail_bulk() - Remove up to @n elements from the tail
+ * @head: header of queue
+ * @chain: empty list receiving the removed elements, in queue order
+ * @n: number of elements to remove
+ *
+ * Return: number of elements moved to @chain, fewer than @n if the queue
+ * ran out
+ */
+size_t q_remove_tail_bulk(struct list_head *head,
+                          struct list_head *chain,
+                          size_t n);
+
 /**
  * q_release_element() - Release the element
  * @e: element would be released
@@ -116,7 +269,8 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
  */
 static inline void q_release_element(element_t *e)
 {
-    test_free(e->value);
+    if (e->value != (char *) (e + 1))
+        test_free(e->value);
     test_free(e);
 }
 
@@ -124,6 +278,8 @@ static inline void q_release_element(element_t *e)
  * q_size() - Get the size of the queue
  * @head: header of queue
  *
+ * Reads the count kept in the header, in constant time.
+ *
  * Return: the number of elements in queue, zero if queue is NULL or empty
  */
 int q_size(struct list_head *head);
@@ -155,6 +311,20 @@ bool q_delete_mid(struct list_head *head);
  */
 bool q_delete_dup(struct list_head *head);
 
+/**
+ * q_delete_dup_unsorted() - Delete all nodes that have duplicate string,
+ *                           without requiring the queue to be sorted
+ * @head: header of queue
+ *
+ * Like q_delete_dup(), but duplicates need not be adjacent.  The distinct
+ * strings keep their original order.  A hash set sized to the queue is
+ * allocated for the duration of the call.
+ *
+ * Return: true for success, false if list is NULL or the set could not be
+ * allocated, in which case the queue is left untouched.
+ */
+bool q_delete_dup_unsorted(struct list_head *head);
+
 /**
  * q_swap() - Swap every two adjacent nodes
  * @head: header of queue
@@ -199,6 +369,19 @@ void q_reverseK(struct list_head *head, int k);
  */
 void q_sort(struct list_head *head);
 
+/**
+ * q_sort_parallel() - Sort elements of queue in ascending order on several
+ *                     threads
+ * @head: header of queue
+ * @nthreads: number of threads to sort on, counting the caller
+ *
+ * The queue is cut into @nthreads parts of equal length, which are sorted
+ * with q_sort() at the same time and then combined by a k-way merge.  Fewer
+ * threads are used when the parts would be too short to pay for them.  Like
+ * q_sort(), no memory is allocated and equal elements keep their order.
+ */
+void q_sort_parallel(struct list_head *head, int nthreads);
+
 /**
  * q_descend() - Remove every node which has a node with a strictly greater
  * value anywhere to the right side of it.
@@ -233,4 +416,87 @@ int q_descend(struct list_head *head);
  */
 int q_merge(struct list_head *head);
 
+/* Concurrent queue.
+ *
+ * mpmc_t is a bounded ring of element pointers that any number of threads
+ * may insert at the tail of and remove from the head of at the same time,
+ * without locks (Vyukov's MPMC queue).  Each slot carries a sequence number
+ * telling producers and consumers whose turn it is, so an operation costs
+ * one compare-and-swap on its end of the ring when uncontended.  Elements
+ * are the same element_t used by the list queue; their list member is not
+ * used while they are in the ring.
+ */
+typedef struct mpmc mpmc_t;
+
+/**
+ * q_mpmc_new() - Create an empty concurrent queue
+ * @capacity: number of elements the queue holds at most, rounded up to a
+ *            power of two
+ *
+ * Return: NULL for allocation failure.
+ */
+mpmc_t *q_mpmc_new(size_t capacity);
+
+/**
+ * q_mpmc_free() - Free the queue and the elements still in it
+ * @q: concurrent queue, or NULL
+ *
+ * No other thread may be using the queue.
+ */
+void q_mpmc_free(mpmc_t *q);
+
+/**
+ * q_mpmc_enqueue() - Append an existing element at the tail
+ * @q: concurrent queue
+ * @e: element to append
+ *
+ * Return: true for success, false if the queue is full.
+ */
+bool q_mpmc_enqueue(mpmc_t *q, element_t *e);
+
+/**
+ * q_mpmc_dequeue() - Take the element at the head
+ * @q: concurrent queue
+ *
+ * Return: the element, or NULL if the queue is empty.
+ */
+element_t *q_mpmc_dequeue(mpmc_t *q);
+
+/**
+ * q_mpmc_insert_tail() - Insert an element holding a copy of @s at the tail
+ * @q: concurrent queue
+ * @s: string to be copied and inserted
+ *
+ * Return: true for success, false for allocation failure, if @s is NULL or
+ * if the queue is full.
+ */
+bool q_mpmc_insert_tail(mpmc_t *q, char *s);
+
+/**
+ * q_mpmc_remove_head() - Remove the element at the head
+ * @q: concurrent queue
+ * @sp: string would be inserted
+ * @bufsize: size of the string
+ *
+ * Same as q_remove_head(); the element is returned rather than freed.
+ *
+ * Return: the removed element, or NULL if the queue is empty.
+ */
+element_t *q_mpmc_remove_head(mpmc_t *q, char *sp, size_t bufsize);
+
+/**
+ * q_mpmc_size() - Number of elements in the queue
+ * @q: concurrent queue
+ *
+ * Exact only while no other thread is inserting or removing.
+ */
+size_t q_mpmc_size(mpmc_t *q);
+
+/**
+ * q_mpmc_retries() - Number of times an operation on @q lost a
+ *                    compare-and-swap to another thread and retried
+ * @q: concurrent queue
+ */
+size_t q_mpmc_retries(mpmc_t *q);
+
 #endif /* LAB0_QUEUE_H */
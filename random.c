@@ -274,7 +274,8 @@ static int randombytes_bsd_randombytes(void *buf, size_t n)
 }
 #endif
 
-int randombytes(uint8_t *buf, size_t n)
+/* Read @n bytes straight from the operating system */
+static int randombytes_os(uint8_t *buf, size_t n)
 {
 #if defined(__linux__) || defined(__GNU__)
 #if defined(USE_GLIBC)
@@ -293,3 +294,150 @@ int randombytes(uint8_t *buf, size_t n)
 #error "randombytes(...) is not supported on this platform"
 #endif
 }
+
+/* User-space generator.
+ *
+ * Each thread runs its own ChaCha20 keystream, keyed once from the
+ * operating system, and hands it out from a buffer refilled a batch of
+ * blocks at a time, so that most calls are a memcpy and none contend.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+/* ChaCha20 blocks generated per refill */
+#define POOL_BLOCKS 16
+#define POOL_SIZE (POOL_BLOCKS * 64)
+
+typedef struct {
+    uint32_t state[16];
+    uint8_t buf[POOL_SIZE];
+    size_t pos; /* next unused byte of buf, POOL_SIZE when drained */
+    unsigned generation;
+    uint64_t bits; /* cached bits for randombit() */
+    int nbits;
+} pool_t;
+
+static _Thread_local pool_t pool = {.pos = POOL_SIZE};
+
+/* Bumped in the child of each fork, which must not replay the keystream of
+ * its parent
+ */
+static volatile unsigned fork_generation = 1;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void pool_forked(void)
+{
+    fork_generation++;
+}
+
+static void pool_atfork(void)
+{
+    pthread_atfork(NULL, NULL, pool_forked);
+}
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(x, a, b, c, d)     \
+    do {                                \
+        x[a] += x[b];                   \
+        x[d] = ROTL32(x[d] ^ x[a], 16); \
+        x[c] += x[d];                   \
+        x[b] = ROTL32(x[b] ^ x[c], 12); \
+        x[a] += x[b];                   \
+        x[d] = ROTL32(x[d] ^ x[a], 8);  \
+        x[c] += x[d];                   \
+        x[b] = ROTL32(x[b] ^ x[c], 7);  \
+    } while (0)
+
+static void chacha20_block(uint32_t state[16], uint8_t out[64])
+{
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        QUARTERROUND(x, 0, 4, 8, 12);
+        QUARTERROUND(x, 1, 5, 9, 13);
+        QUARTERROUND(x, 2, 6, 10, 14);
+        QUARTERROUND(x, 3, 7, 11, 15);
+        QUARTERROUND(x, 0, 5, 10, 15);
+        QUARTERROUND(x, 1, 6, 11, 12);
+        QUARTERROUND(x, 2, 7, 8, 13);
+        QUARTERROUND(x, 3, 4, 9, 14);
+    }
+    for (int i = 0; i < 16; i++) {
+        uint32_t v = x[i] + state[i];
+        out[4 * i] = v;
+        out[4 * i + 1] = v >> 8;
+        out[4 * i + 2] = v >> 16;
+        out[4 * i + 3] = v >> 24;
+    }
+    /* 64-bit block counter */
+    if (!++state[12])
+        state[13]++;
+}
+
+/* Key a fresh keystream: "expand 32-byte k", 256-bit key, zero counter,
+ * 64-bit nonce
+ */
+static int pool_seed(pool_t *p)
+{
+    static const uint32_t sigma[4] = {0x61707865, 0x3320646e, 0x79622d32,
+                                      0x6b206574};
+    uint32_t key[10];
+    if (randombytes_os((uint8_t *) key, sizeof(key)))
+        return -1;
+
+    memcpy(p->state, sigma, sizeof(sigma));
+    memcpy(p->state + 4, key, 8 * sizeof(uint32_t));
+    p->state[12] = p->state[13] = 0;
+    p->state[14] = key[8];
+    p->state[15] = key[9];
+    p->pos = POOL_SIZE;
+    p->nbits = 0;
+    p->generation = fork_generation;
+    return 0;
+}
+
+static void pool_refill(pool_t *p)
+{
+    for (int i = 0; i < POOL_BLOCKS; i++)
+        chacha20_block(p->state, p->buf + 64 * i);
+    p->pos = 0;
+}
+
+int randombytes(uint8_t *buf, size_t n)
+{
+    pool_t *p = &pool;
+    if (p->generation != fork_generation) {
+        pthread_once(&atfork_once, pool_atfork);
+        if (pool_seed(p))
+            return -1;
+    }
+
+    while (n) {
+        if (p->pos == POOL_SIZE)
+            pool_refill(p);
+        size_t chunk = POOL_SIZE - p->pos < n ? POOL_SIZE - p->pos : n;
+        memcpy(buf, p->buf + p->pos, chunk);
+        /* Bytes handed out are not kept around */
+        memset(p->buf + p->pos, 0, chunk);
+        p->pos += chunk;
+        buf += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+uint8_t randombit(void)
+{
+    pool_t *p = &pool;
+    if (!p->nbits || p->generation != fork_generation) {
+        if (randombytes((uint8_t *) &p->bits, sizeof(p->bits)))
+            return 0;
+        p->nbits = 64;
+    }
+    uint8_t bit = p->bits & 1;
+    p->bits >>= 1;
+    p->nbits--;
+    return bit;
+}
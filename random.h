@@ -4,14 +4,14 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Fill @buf with @len random bytes from a ChaCha20 keystream private to the
+ * calling thread, keyed from the operating system on first use and again
+ * after fork().  Returns 0 on success, -1 if no key could be obtained.
+ */
 extern int randombytes(uint8_t *buf, size_t len);
 
-static inline uint8_t randombit(void)
-{
-    uint8_t ret = 0;
-    randombytes(&ret, 1);
-    return ret & 1;
-}
+/* A random bit, taken from a cached word of randombytes() output */
+extern uint8_t randombit(void);
 
 #if INTPTR_MAX == INT64_MAX
 #define M_INTPTR_SHIFT (3)
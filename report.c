@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -51,6 +52,203 @@ bool set_logfile(char *file_name)
     return logfile != NULL;
 }
 
+/* Asynchronous reports.
+ *
+ * Each thread formats its reports straight into chunks of its own, one for
+ * the console and one for the log file.  A full chunk is copied into a ring
+ * and written out by a background thread, so the thread reporting never
+ * waits for the files unless the whole ring is full.  report_flush() waits
+ * until the ring is empty; it is called after every command from the web,
+ * before every prompt, at finish_cmd() and on fatal errors.
+ */
+#define LOG_CHUNK 16384
+#define LOG_RING 16
+
+/* Files a chunk may go to, looked up when it is written */
+typedef enum { LOG_VERB, LOG_ERR, LOG_FILE } log_dest_t;
+
+typedef struct {
+    log_dest_t dest;
+    size_t len;
+    char data[LOG_CHUNK];
+} log_chunk_t;
+
+static bool log_async = false;
+
+/* Chunks submitted and written so far, the ring holds those in between */
+static log_chunk_t ring[LOG_RING];
+static size_t ring_head = 0, ring_tail = 0;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_filled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ring_drained = PTHREAD_COND_INITIALIZER;
+
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static bool writer_started = false;
+static pthread_t writer;
+static pthread_key_t staged_key;
+
+/* Chunks being filled by this thread: console and log file */
+static _Thread_local log_chunk_t staged[2];
+static _Thread_local bool staged_registered = false;
+
+static FILE *log_file_of(log_dest_t dest)
+{
+    switch (dest) {
+    case LOG_VERB:
+        return verbfile;
+    case LOG_ERR:
+        return errfile;
+    default:
+        return logfile;
+    }
+}
+
+static void *log_writer(void *arg)
+{
+    pthread_mutex_lock(&ring_lock);
+    for (;;) {
+        while (ring_tail == ring_head)
+            pthread_cond_wait(&ring_filled, &ring_lock);
+        log_chunk_t *c = &ring[ring_tail % LOG_RING];
+        /* The log file may be closed by report_event(), under the lock */
+        FILE *f = log_file_of(c->dest);
+        if (c->dest == LOG_FILE && f) {
+            fwrite(c->data, 1, c->len, f);
+            fflush(f);
+        }
+        pthread_mutex_unlock(&ring_lock);
+        if (c->dest != LOG_FILE && f) {
+            fwrite(c->data, 1, c->len, f);
+            fflush(f);
+        }
+        pthread_mutex_lock(&ring_lock);
+        ring_tail++;
+        pthread_cond_broadcast(&ring_drained);
+    }
+    return NULL;
+}
+
+/* Hand chunk @c over to the writer thread and empty it */
+static void log_submit(log_chunk_t *c)
+{
+    if (!c->len)
+        return;
+
+    /* A signal handler unwinding with siglongjmp() must not leave the ring
+     * locked, and the mask is restored by it anyway
+     */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    pthread_mutex_lock(&ring_lock);
+    while (ring_head - ring_tail == LOG_RING)
+        pthread_cond_wait(&ring_drained, &ring_lock);
+    log_chunk_t *slot = &ring[ring_head % LOG_RING];
+    slot->dest = c->dest;
+    slot->len = c->len;
+    memcpy(slot->data, c->data, c->len);
+    ring_head++;
+    pthread_cond_signal(&ring_filled);
+    pthread_mutex_unlock(&ring_lock);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    c->len = 0;
+}
+
+/* Submit what a thread left in its chunks when it exits */
+static void log_thread_exit(void *chunks)
+{
+    log_chunk_t *c = chunks;
+    log_submit(&c[0]);
+    log_submit(&c[1]);
+}
+
+/* Write out everything the calling thread reported so far */
+static void log_drain(void)
+{
+    if (!writer_started)
+        return;
+    log_submit(&staged[0]);
+    log_submit(&staged[1]);
+    pthread_mutex_lock(&ring_lock);
+    while (ring_tail != ring_head)
+        pthread_cond_wait(&ring_drained, &ring_lock);
+    pthread_mutex_unlock(&ring_lock);
+}
+
+static void log_writer_start(void)
+{
+    if (pthread_key_create(&staged_key, log_thread_exit))
+        return;
+
+    /* Signals are for the threads running commands */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    writer_started = !pthread_create(&writer, NULL, log_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (writer_started)
+        atexit(log_drain);
+}
+
+bool set_log_async(bool on)
+{
+    if (on)
+        pthread_once(&writer_once, log_writer_start);
+    else
+        log_drain();
+    log_async = on && writer_started;
+    return log_async == on;
+}
+
+/* Print to the file of @dest, through the writer thread when asynchronous */
+static void log_vprintf(log_dest_t dest, const char *fmt, va_list ap)
+{
+    FILE *f = log_file_of(dest);
+    if (!log_async) {
+        vfprintf(f, fmt, ap);
+        fflush(f);
+        return;
+    }
+
+    log_chunk_t *c = &staged[dest == LOG_FILE];
+    if (!staged_registered) {
+        pthread_setspecific(staged_key, staged);
+        staged_registered = true;
+    }
+    if (c->len && c->dest != dest)
+        log_submit(c);
+    c->dest = dest;
+
+    for (;;) {
+        va_list aq;
+        va_copy(aq, ap);
+        int n = vsnprintf(c->data + c->len, LOG_CHUNK - c->len, fmt, aq);
+        va_end(aq);
+        if (n < 0)
+            return;
+        if (c->len + n < LOG_CHUNK) {
+            c->len += n;
+            return;
+        }
+        if (!c->len)
+            break;
+        log_submit(c);
+    }
+
+    /* Longer than a whole chunk, write it here after what came before */
+    log_drain();
+    vfprintf(f, fmt, ap);
+    fflush(f);
+}
+
+static void log_printf(log_dest_t dest, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    log_vprintf(dest, fmt, ap);
+    va_end(ap);
+}
+
 void report_event(message_t msg, char *fmt, ...)
 {
     va_list ap;
@@ -72,23 +270,26 @@ void report_event(message_t msg, char *fmt, ...)
         init_files(stdout, stdout);
 
     va_start(ap, fmt);
-    fprintf(errfile, "%s: ", msg_name);
-    vfprintf(errfile, fmt, ap);
-    fprintf(errfile, "\n");
-    fflush(errfile);
+    log_printf(LOG_ERR, "%s: ", msg_name);
+    log_vprintf(LOG_ERR, fmt, ap);
+    log_printf(LOG_ERR, "\n");
     va_end(ap);
 
     if (logfile) {
         va_start(ap, fmt);
-        fprintf(logfile, "Error: ");
-        vfprintf(logfile, fmt, ap);
-        fprintf(logfile, "\n");
-        fflush(logfile);
+        log_printf(LOG_FILE, "Error: ");
+        log_vprintf(LOG_FILE, fmt, ap);
+        log_printf(LOG_FILE, "\n");
         va_end(ap);
+        log_drain();
+        pthread_mutex_lock(&ring_lock);
         fclose(logfile);
+        logfile = NULL;
+        pthread_mutex_unlock(&ring_lock);
     }
 
     if (fatal) {
+        log_drain();
         if (fatal_fun)
             fatal_fun();
         exit(1);
@@ -97,6 +298,43 @@ void report_event(message_t msg, char *fmt, ...)
 
 #define BUF_SIZE 4096
 extern int web_connfd;
+
+/* Output for the web client, batched into chunks of up to BUF_SIZE bytes */
+static char sink[BUF_SIZE];
+static size_t sink_len = 0;
+
+static void sink_flush(void)
+{
+    if (!sink_len)
+        return;
+    sink[sink_len] = '\0';
+    if (web_connfd)
+        web_send(web_connfd, sink);
+    sink_len = 0;
+}
+
+void report_flush(void)
+{
+    log_drain();
+    sink_flush();
+}
+
+static void sink_write(const char *s)
+{
+    size_t len = strlen(s);
+    while (len) {
+        size_t n = sizeof(sink) - 1 - sink_len;
+        if (n > len)
+            n = len;
+        memcpy(sink + sink_len, s, n);
+        sink_len += n;
+        s += n;
+        len -= n;
+        if (sink_len == sizeof(sink) - 1)
+            sink_flush();
+    }
+}
+
 void report(int level, char *fmt, ...)
 {
     if (!verbfile)
@@ -106,27 +344,23 @@ void report(int level, char *fmt, ...)
     if (level <= verblevel) {
         va_list ap;
         va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fprintf(verbfile, "\n");
-        fflush(verbfile);
+        log_vprintf(LOG_VERB, fmt, ap);
+        log_printf(LOG_VERB, "\n");
         va_end(ap);
 
         if (logfile) {
             va_start(ap, fmt);
-            vfprintf(logfile, fmt, ap);
-            fprintf(logfile, "\n");
-            fflush(logfile);
+            log_vprintf(LOG_FILE, fmt, ap);
+            log_printf(LOG_FILE, "\n");
             va_end(ap);
         }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
-        va_end(ap);
-    }
-    if (web_connfd) {
-        int len = strlen(buffer);
-        buffer[len] = '\n';
-        buffer[len + 1] = '\0';
-        web_send(web_connfd, buffer);
+        if (web_connfd) {
+            va_start(ap, fmt);
+            vsnprintf(buffer, BUF_SIZE, fmt, ap);
+            va_end(ap);
+            sink_write(buffer);
+            sink_write("\n");
+        }
     }
 }
 
@@ -139,23 +373,21 @@ void report_noreturn(int level, char *fmt, ...)
     if (level <= verblevel) {
         va_list ap;
         va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fflush(verbfile);
+        log_vprintf(LOG_VERB, fmt, ap);
         va_end(ap);
 
         if (logfile) {
             va_start(ap, fmt);
-            vfprintf(logfile, fmt, ap);
-            fflush(logfile);
+            log_vprintf(LOG_FILE, fmt, ap);
             va_end(ap);
         }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
-        va_end(ap);
+        if (web_connfd) {
+            va_start(ap, fmt);
+            vsnprintf(buffer, BUF_SIZE, fmt, ap);
+            va_end(ap);
+            sink_write(buffer);
+        }
     }
-
-    if (web_connfd)
-        web_send(web_connfd, buffer);
 }
 
 /* Functions denoting failures */
@@ -163,6 +395,7 @@ void report_noreturn(int level, char *fmt, ...)
 /* Need to be able to print without using malloc */
 static void fail_fun(char *format, char *msg)
 {
+    log_drain();
     snprintf(fail_buf, sizeof(fail_buf), format, msg);
     /* Tack on return */
     fail_buf[strlen(fail_buf)] = '\n';
@@ -298,6 +531,11 @@ void free_string(char *s)
     free_block((void *) s, strlen(s) + 1);
 }
 
+size_t peak_bytes_used(void)
+{
+    return peak_bytes;
+}
+
 /* Initialization of timers */
 void init_time(double *timep)
 {
@@ -14,6 +14,11 @@ typedef enum { MSG_WARN, MSG_ERROR, MSG_FATAL, N_MSG } message_t;
 
 bool set_logfile(char *file_name);
 
+/* Have reports written by a background thread, or again by the caller.
+ * Returns false if the thread could not be started.
+ */
+bool set_log_async(bool on);
+
 extern int verblevel;
 void set_verblevel(int level);
 
@@ -26,6 +31,11 @@ void report(int verblevel, char *fmt, ...);
 /* Like report, but without return character */
 void report_noreturn(int verblevel, char *fmt, ...);
 
+/* Write out what this thread reported so far, and send what report() and
+ * report_noreturn() collected for the web client
+ */
+void report_flush(void);
+
 /* Attempt to call malloc.  Fail when returns NULL */
 void *malloc_or_fail(size_t bytes, char *fun_name);
 
@@ -44,6 +54,9 @@ void free_array(void *b, size_t cnt, size_t bytes);
 /* Free string saved by strsave_or_fail */
 void free_string(char *s);
 
+/* Largest number of bytes held at once through the functions above */
+size_t peak_bytes_used(void);
+
 /* Time counted as fp number in seconds */
 void init_time(double *timep);
 
@@ -4,6 +4,11 @@ from __future__ import print_function
 import subprocess
 import sys
 import getopt
+import json
+import os
+import tempfile
+import time
+from concurrent.futures import ThreadPoolExecutor
 
 
 
@@ -35,7 +40,8 @@ class Tracer:
         14: "trace-14-perf",
         15: "trace-15-perf",
         16: "trace-16-perf",
-        17: "trace-17-complexity"
+        17: "trace-17-complexity",
+        18: "trace-18-scaling"
     }
 
     traceProbs = {
@@ -55,10 +61,14 @@ class Tracer:
         14: "Trace-14",
         15: "Trace-15",
         16: "Trace-16",
-        17: "Trace-17"
+        17: "Trace-17",
+        18: "Trace-18"
     }
 
-    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5]
+    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5, 5]
+
+    # Traces timing qtest itself, which must not share a CPU with other traces
+    timingTraces = [17, 18]
 
     RED = '\033[91m'
     GREEN = '\033[92m'
@@ -69,33 +79,145 @@ class Tracer:
                  verbLevel=0,
                  autograde=False,
                  useValgrind=False,
-                 colored=False):
+                 colored=False,
+                 jobs=1,
+                 jsonFile=None):
         if qtest != "":
             self.qtest = qtest
         self.verbLevel = verbLevel
         self.autograde = autograde
         self.useValgrind = useValgrind
         self.colored = colored
+        self.jobs = jobs
+        self.jsonFile = jsonFile
 
     def printInColor(self, text, color):
         if self.colored == False:
             color = self.WHITE
         print(color, text, self.WHITE, sep = '')
 
-    def runTrace(self, tid):
+    def readStats(self, sname):
+        stats = {}
+        try:
+            with open(sname) as f:
+                for line in f:
+                    key, value = line.split()
+                    stats[key] = int(value)
+        except (IOError, ValueError):
+            pass
+        return stats
+
+    # Run one trace, with its output kept in the result when capture is set
+    # and the process pinned to cpus when given
+    def runTrace(self, tid, capture=False, cpus=None):
+        result = {"id": tid, "name": self.traceDict.get(tid), "ok": False,
+                  "wall_time": None, "max_rss_kb": None, "peak_bytes": None,
+                  "output": ""}
         if not tid in self.traceDict:
             self.printInColor("ERROR: No trace with id %d" % tid, self.RED)
-            return False
+            return result
         fname = "%s/%s.cmd" % (self.traceDirectory, self.traceDict[tid])
         vname = "%d" % self.verbLevel
-        clist = self.command + ["-v", vname, "-f", fname]
+        fd, sname = tempfile.mkstemp(prefix="qtest-", suffix=".stat")
+        os.close(fd)
+        clist = self.command + ["-v", vname, "-f", fname, "-s", sname]
 
+        preexec = None
+        if cpus:
+            preexec = lambda: os.sched_setaffinity(0, cpus)
+        start = time.monotonic()
         try:
-            retcode = subprocess.call(clist)
+            p = subprocess.Popen(clist,
+                                 stdout=subprocess.PIPE if capture else None,
+                                 stderr=subprocess.STDOUT if capture else None,
+                                 preexec_fn=preexec)
         except Exception as e:
+            os.remove(sname)
             self.printInColor("Call of '%s' failed: %s" % (" ".join(clist), e), self.RED)
-            return False
-        return retcode == 0
+            return result
+        if capture:
+            result["output"] = p.stdout.read().decode(errors="replace")
+            p.stdout.close()
+        # Reap the child here rather than in Popen, for its resource usage
+        _, status, usage = os.wait4(p.pid, 0)
+        p.returncode = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1
+
+        result["wall_time"] = round(time.monotonic() - start, 3)
+        stats = self.readStats(sname)
+        os.remove(sname)
+        # qtest knows its own peak RSS better, as ru_maxrss also counts what
+        # the forked child shared with this script before exec.  ru_maxrss
+        # counts bytes on macOS and kilobytes elsewhere.
+        rss = usage.ru_maxrss
+        if sys.platform == "darwin":
+            rss //= 1024
+        result["max_rss_kb"] = stats.get("max_rss_kb", rss)
+        result["peak_bytes"] = stats.get("peak_bytes")
+        result["ok"] = p.returncode == 0
+        return result
+
+    # Run the traces of tidList, yielding their results in order.  With more
+    # than one job, the traces run concurrently, except for timingTraces: they
+    # run one at a time on a CPU of their own, or after all the others when
+    # there is no CPU to spare.
+    def runTraces(self, tidList):
+        if self.jobs <= 1:
+            for t in tidList:
+                if self.verbLevel > 0:
+                    print("+++ TESTING trace %s:" % self.traceDict[t])
+                    sys.stdout.flush()
+                yield self.runTrace(t)
+            return
+
+        cpus = None
+        if hasattr(os, "sched_getaffinity"):
+            cpus = sorted(os.sched_getaffinity(0))
+        isolated = cpus and len(cpus) > 1
+        shared = set(cpus[:-1]) if isolated else None
+        timing = set(cpus[-1:]) if isolated else None
+
+        pool = ThreadPoolExecutor(max_workers=self.jobs)
+        serial = ThreadPoolExecutor(max_workers=1)
+        pending = {}
+        for t in tidList:
+            if not t in self.timingTraces:
+                pending[t] = pool.submit(self.runTrace, t, True, shared)
+            elif isolated:
+                pending[t] = serial.submit(self.runTrace, t, True, timing)
+        for t in tidList:
+            if not t in pending:
+                # Nothing else may run meanwhile
+                pool.shutdown(wait=True)
+                pending[t] = serial.submit(self.runTrace, t, True)
+            yield pending[t].result()
+        pool.shutdown()
+        serial.shutdown()
+
+    def writeJson(self, results, score, maxscore, elapsed):
+        try:
+            commit = subprocess.check_output(
+                ["git", "rev-parse", "HEAD"],
+                stderr=subprocess.DEVNULL).decode().strip()
+        except Exception:
+            commit = None
+        report = {
+            "time": time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime()),
+            "commit": commit,
+            "qtest": self.qtest,
+            "valgrind": self.useValgrind,
+            "jobs": self.jobs,
+            "wall_time": round(elapsed, 3),
+            "score": score,
+            "max_score": maxscore,
+            "traces": [{k: v for k, v in r.items() if k != "output"}
+                       for r in results]
+        }
+        if self.jsonFile == "-":
+            print(json.dumps(report, indent=2))
+        else:
+            with open(self.jsonFile, "w") as f:
+                json.dump(report, f, indent=2)
+                f.write("\n")
 
     def run(self, tid=0):
         scoreDict = {k: 0 for k in self.traceDict.keys()}
@@ -113,11 +235,17 @@ class Tracer:
             self.command = ['valgrind', self.qtest]
         else:
             self.command = [self.qtest]
-        for t in tidList:
+        results = []
+        start = time.monotonic()
+        for result in self.runTraces(tidList):
+            t = result["id"]
             tname = self.traceDict[t]
-            if self.verbLevel > 0:
-                print("+++ TESTING trace %s:" % tname)
-            ok = self.runTrace(t)
+            if self.jobs > 1:
+                if self.verbLevel > 0:
+                    print("+++ TESTING trace %s:" % tname)
+                sys.stdout.write(result["output"])
+                sys.stdout.flush()
+            ok = result["ok"]
             maxval = self.maxScores[t]
             tval = maxval if ok else 0
             if tval < maxval:
@@ -127,6 +255,8 @@ class Tracer:
             score += tval
             maxscore += maxval
             scoreDict[t] = tval
+            results.append(result)
+        elapsed = time.monotonic() - start
         if score < maxscore:
             self.printInColor("---\tTOTAL\t\t%d/%d" % (score, maxscore), self.RED)
         else:
@@ -142,16 +272,20 @@ class Tracer:
                 jstring += '"%s" : %d' % (self.traceProbs[k], scoreDict[k])
             jstring += '}}'
             print(jstring)
+        if self.jsonFile:
+            self.writeJson(results, score, maxscore, elapsed)
         if score < maxscore:
             sys.exit(1)
 
 def usage(name):
-    print("Usage: %s [-h] [-p PROG] [-t TID] [-v VLEVEL] [--valgrind] [-c]" % name)
+    print("Usage: %s [-h] [-p PROG] [-t TID] [-v VLEVEL] [-j JOBS] [--valgrind] [-c] [--json FILE]" % name)
     print("  -h        Print this message")
     print("  -p PROG   Program to test")
     print("  -t TID    Trace ID to test")
     print("  -v VLEVEL Set verbosity level (0-3)")
+    print("  -j JOBS   Run up to JOBS traces at once, 0 for one per CPU")
     print("  -c Enable colored text")
+    print("  --json FILE Write scores, wall time, peak RSS and peak_bytes of each trace to FILE, - for stdout")
     sys.exit(0)
 
 
@@ -163,8 +297,10 @@ def run(name, args):
     autograde = False
     useValgrind = False
     colored = False
+    jobs = 1
+    jsonFile = None
 
-    optlist, args = getopt.getopt(args, 'hp:t:v:A:c', ['valgrind'])
+    optlist, args = getopt.getopt(args, 'hp:t:v:A:cj:', ['valgrind', 'json='])
     for (opt, val) in optlist:
         if opt == '-h':
             usage(name)
@@ -181,6 +317,10 @@ def run(name, args):
             useValgrind = True
         elif opt == '-c':
             colored = True
+        elif opt == '-j':
+            jobs = int(val) or os.cpu_count() or 1
+        elif opt == '--json':
+            jsonFile = val
         else:
             print("Unrecognized option '%s'" % opt)
             usage(name)
@@ -190,7 +330,9 @@ def run(name, args):
                verbLevel=vlevel,
                autograde=autograde,
                useValgrind=useValgrind,
-               colored=colored)
+               colored=colored,
+               jobs=jobs,
+               jsonFile=jsonFile)
     t.run(tid)
 
 
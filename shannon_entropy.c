@@ -1,4 +1,6 @@
 #include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -8,27 +10,62 @@
 /* Shannon full integer entropy calculation */
 #define BUCKET_SIZE (1 << 8)
 
-double shannon_entropy(const uint8_t *s)
+/* log2_lshift16() of every argument it can get here, from 0 up to
+ * LOG2_ARG_SHIFT, so that each bucket costs one load instead of a walk down
+ * its tree of branches.  All values lie in [-136, 0].
+ */
+static int8_t log2_table[LOG2_ARG_SHIFT + 1];
+static pthread_once_t log2_table_once = PTHREAD_ONCE_INIT;
+
+static void log2_table_init()
 {
-    assert(s);
-    const uint64_t count = strlen((char *) s);
-    uint64_t entropy_sum = 0;
-    const uint64_t entropy_max = 8 * LOG2_RET_SHIFT;
+    for (uint32_t i = 0; i <= LOG2_ARG_SHIFT; i++)
+        log2_table[i] = log2_lshift16(i);
+}
+
+/* Byte counts of the string being measured.  Every call clears the buckets
+ * it used when it reads them, so that the next one needs neither to clear
+ * all of them first nor to scan all of them after.
+ */
+static _Thread_local uint32_t bucket[BUCKET_SIZE];
 
-    uint32_t bucket[256];
-    memset(&bucket, 0, sizeof(bucket));
+/* Entropy of @s, once the table is ready */
+static double entropy_of(const uint8_t *s)
+{
+    /* Counting stops at the terminator, so the string is read only once */
+    uint32_t count = 0;
+    for (const uint8_t *c = s; *c; c++, count++)
+        bucket[*c]++;
 
-    for (uint32_t i = 0; i < count; i++)
-        bucket[s[i]]++;
+    uint64_t entropy_sum = 0;
+    const uint64_t entropy_max = 8 * LOG2_RET_SHIFT;
+    const uint64_t scale = count ? LOG2_ARG_SHIFT / count : 0;
 
-    for (uint32_t i = 0; i < BUCKET_SIZE; i++) {
-        if (bucket[i]) {
-            uint64_t p = bucket[i];
-            p *= LOG2_ARG_SHIFT / count;
-            entropy_sum += -p * log2_lshift16(p);
+    for (const uint8_t *c = s; *c; c++) {
+        if (bucket[*c]) {
+            uint64_t p = bucket[*c] * scale;
+            bucket[*c] = 0;
+            entropy_sum += p * (uint64_t) -log2_table[p];
         }
     }
 
     entropy_sum /= LOG2_ARG_SHIFT;
     return entropy_sum * 100.0 / entropy_max;
 }
+
+double shannon_entropy(const uint8_t *s)
+{
+    assert(s);
+    pthread_once(&log2_table_once, log2_table_init);
+    return entropy_of(s);
+}
+
+/* Entropy of each of the @n strings at @s, stored into @entropy */
+void shannon_entropy_batch(const uint8_t *const s[], size_t n, double *entropy)
+{
+    pthread_once(&log2_table_once, log2_table_init);
+    for (size_t i = 0; i < n; i++) {
+        assert(s[i]);
+        entropy[i] = entropy_of(s[i]);
+    }
+}
@@ -1,5 +1,6 @@
-# Test if time complexity of q_insert_tail, q_insert_head, q_remove_tail, and q_remove_head is constant
+# Test if time complexity of q_size, q_insert_tail, q_insert_head, q_remove_tail, and q_remove_head is constant
 option simulation 1
+size
 it
 ih
 rh
@@ -0,0 +1,7 @@
+# Test if q_delete_mid, q_reverse and q_merge are at most linear, and q_sort at most linearithmic
+option simulation 1
+dm
+reverse
+sort
+merge
+option simulation 0
@@ -0,0 +1,212 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "unrolled.h"
+
+/* Chunks given up by uq_to_list(), linked through their list member */
+static LIST_HEAD(spares);
+
+static uq_chunk_t *chunk_new()
+{
+    if (!list_empty(&spares)) {
+        uq_chunk_t *c = list_first_entry(&spares, uq_chunk_t, list);
+        list_del(&c->list);
+        return c;
+    }
+    return malloc(sizeof(uq_chunk_t));
+}
+
+/* Take @c off its queue once its last element is gone */
+static void chunk_drop(uq_chunk_t *c)
+{
+    list_del(&c->list);
+    free(c);
+}
+
+/* Create an empty unrolled queue */
+uq_t *uq_new()
+{
+    uq_t *q = malloc(sizeof(uq_t));
+    if (!q)
+        return NULL;
+
+    INIT_LIST_HEAD(&q->chunks);
+    return q;
+}
+
+/* Free all storage used by the unrolled queue */
+void uq_free(uq_t *q)
+{
+    if (!q)
+        return;
+
+    uq_chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, &q->chunks, list) {
+        for (uint32_t i = c->start; i < c->start + c->count; i++)
+            q_release_element(c->slot[i]);
+        free(c);
+    }
+    free(q);
+}
+
+/* Hand out @e as the list queue would, with its string copied to @sp */
+static element_t *element_take(element_t *e, char *sp, size_t bufsize)
+{
+    INIT_LIST_HEAD(&e->list);
+    return q_element_copy(e, sp, bufsize);
+}
+
+/* Insert an element at head of the unrolled queue */
+bool uq_insert_head(uq_t *q, char *s)
+{
+    if (!q || !s)
+        return false;
+
+    element_t *e = q_element_new(s);
+    if (!e)
+        return false;
+
+    uq_chunk_t *c = list_empty(&q->chunks)
+                        ? NULL
+                        : list_first_entry(&q->chunks, uq_chunk_t, list);
+    if (!c || !c->start) {
+        c = chunk_new();
+        if (!c) {
+            q_release_element(e);
+            return false;
+        }
+        c->start = UQ_CHUNK;
+        c->count = 0;
+        list_add(&c->list, &q->chunks);
+    }
+    c->slot[--c->start] = e;
+    c->count++;
+    return true;
+}
+
+/* Insert an element at tail of the unrolled queue */
+bool uq_insert_tail(uq_t *q, char *s)
+{
+    if (!q || !s)
+        return false;
+
+    element_t *e = q_element_new(s);
+    if (!e)
+        return false;
+
+    uq_chunk_t *c = list_empty(&q->chunks)
+                        ? NULL
+                        : list_last_entry(&q->chunks, uq_chunk_t, list);
+    if (!c || c->start + c->count == UQ_CHUNK) {
+        c = chunk_new();
+        if (!c) {
+            q_release_element(e);
+            return false;
+        }
+        c->start = 0;
+        c->count = 0;
+        list_add_tail(&c->list, &q->chunks);
+    }
+    c->slot[c->start + c->count++] = e;
+    return true;
+}
+
+/* Remove an element from head of the unrolled queue */
+element_t *uq_remove_head(uq_t *q, char *sp, size_t bufsize)
+{
+    if (!q || list_empty(&q->chunks))
+        return NULL;
+
+    uq_chunk_t *c = list_first_entry(&q->chunks, uq_chunk_t, list);
+    element_t *e = c->slot[c->start++];
+    if (!--c->count)
+        chunk_drop(c);
+    return element_take(e, sp, bufsize);
+}
+
+/* Remove an element from tail of the unrolled queue */
+element_t *uq_remove_tail(uq_t *q, char *sp, size_t bufsize)
+{
+    if (!q || list_empty(&q->chunks))
+        return NULL;
+
+    uq_chunk_t *c = list_last_entry(&q->chunks, uq_chunk_t, list);
+    element_t *e = c->slot[c->start + --c->count];
+    if (!c->count)
+        chunk_drop(c);
+    return element_take(e, sp, bufsize);
+}
+
+/* Return number of elements in the unrolled queue */
+int uq_size(const uq_t *q)
+{
+    if (!q)
+        return 0;
+
+    int size = 0;
+    const uq_chunk_t *c;
+    list_for_each_entry (c, &q->chunks, list)
+        size += c->count;
+    return size;
+}
+
+/* Reverse elements in the unrolled queue */
+void uq_reverse(uq_t *q)
+{
+    if (!q)
+        return;
+
+    uq_chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, &q->chunks, list) {
+        element_t **lo = c->slot + c->start, **hi = lo + c->count - 1;
+        for (; lo < hi; lo++, hi--) {
+            element_t *tmp = *lo;
+            *lo = *hi;
+            *hi = tmp;
+        }
+        list_move(&c->list, &q->chunks);
+    }
+}
+
+/* Link the elements of the unrolled queue on a list queue */
+void uq_to_list(uq_t *q, struct list_head *head)
+{
+    if (!q)
+        return;
+
+    uq_chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, &q->chunks, list) {
+        for (uint32_t i = c->start; i < c->start + c->count; i++)
+            q_link_tail(head, c->slot[i]);
+        list_move_tail(&c->list, &spares);
+    }
+}
+
+/* Pack the elements of a list queue into the unrolled queue */
+bool uq_from_list(uq_t *q, struct list_head *head)
+{
+    if (!q)
+        return list_empty(head);
+
+    while (!list_empty(head)) {
+        uq_chunk_t *c = chunk_new();
+        if (!c)
+            return false;
+        c->start = 0;
+        c->count = 0;
+        while (c->count < UQ_CHUNK && !list_empty(head))
+            c->slot[c->count++] = q_remove_head(head, NULL, 0);
+        list_add_tail(&c->list, &q->chunks);
+    }
+    return true;
+}
+
+/* Free the spare chunks */
+void uq_release_spares()
+{
+    uq_chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, &spares, list) {
+        list_del(&c->list);
+        free(c);
+    }
+}
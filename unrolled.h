@@ -0,0 +1,177 @@
+#ifndef LAB0_UNROLLED_H
+#define LAB0_UNROLLED_H
+
+/* An unrolled queue keeps the pointers to its elements in fixed-size chunks
+ * rather than linking the elements themselves, so that walking the queue
+ * reads a few consecutive cache lines per chunk instead of taking a cache
+ * miss at every element.  The elements are the element_t of the list queue;
+ * their list member is unused while they are held in chunks.
+ *
+ * Insertion and removal at either end, size and reverse are done on the
+ * chunks.  Every other queue operation runs on the list queue: uq_to_list()
+ * links the elements in order, and uq_from_list() packs them back.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "queue.h"
+
+/* Element pointers per chunk, for a chunk of 512 bytes */
+#define UQ_CHUNK 61
+
+/**
+ * uq_chunk_t - Run of consecutive elements of an unrolled queue
+ * @list: node in the list of chunks, in queue order
+ * @start: index of the first element in @slot
+ * @count: number of elements, at least one
+ * @slot: the elements, from @slot[@start] to @slot[@start + @count - 1]
+ */
+typedef struct {
+    struct list_head list;
+    uint32_t start;
+    uint32_t count;
+    element_t *slot[UQ_CHUNK];
+} uq_chunk_t;
+
+/**
+ * uq_t - Unrolled queue
+ * @chunks: list of uq_chunk_t, none of them empty
+ */
+typedef struct {
+    struct list_head chunks;
+} uq_t;
+
+/**
+ * uq_new() - Create an empty unrolled queue
+ *
+ * Return: NULL for allocation failure.
+ */
+uq_t *uq_new();
+
+/**
+ * uq_free() - Free all storage used by the unrolled queue, elements included
+ * @q: unrolled queue, or NULL
+ */
+void uq_free(uq_t *q);
+
+/**
+ * uq_insert_head() - Insert an element holding a copy of @s at the head
+ * @q: unrolled queue
+ * @s: string to be copied and inserted
+ *
+ * Return: true for success, false if @q or @s is NULL or allocation failed.
+ */
+bool uq_insert_head(uq_t *q, char *s);
+
+/**
+ * uq_insert_tail() - Insert an element holding a copy of @s at the tail
+ * @q: unrolled queue
+ * @s: string to be copied and inserted
+ *
+ * Return: true for success, false if @q or @s is NULL or allocation failed.
+ */
+bool uq_insert_tail(uq_t *q, char *s);
+
+/**
+ * uq_remove_head() - Remove the element at the head
+ * @q: unrolled queue
+ * @sp: string would be inserted
+ * @bufsize: size of the string
+ *
+ * Same as q_remove_head().
+ *
+ * Return: the removed element, or NULL if @q is NULL or empty.
+ */
+element_t *uq_remove_head(uq_t *q, char *sp, size_t bufsize);
+
+/**
+ * uq_remove_tail() - Remove the element at the tail
+ * @q: unrolled queue
+ * @sp: string would be inserted
+ * @bufsize: size of the string
+ *
+ * Same as q_remove_tail().
+ *
+ * Return: the removed element, or NULL if @q is NULL or empty.
+ */
+element_t *uq_remove_tail(uq_t *q, char *sp, size_t bufsize);
+
+/**
+ * uq_head() - First element of the unrolled queue
+ * @q: unrolled queue
+ *
+ * Return: the element, or NULL if @q is empty.
+ */
+static inline element_t *uq_head(const uq_t *q)
+{
+    if (list_empty(&q->chunks))
+        return NULL;
+    const uq_chunk_t *c = list_first_entry(&q->chunks, uq_chunk_t, list);
+    return c->slot[c->start];
+}
+
+/**
+ * uq_tail() - Last element of the unrolled queue
+ * @q: unrolled queue
+ *
+ * Return: the element, or NULL if @q is empty.
+ */
+static inline element_t *uq_tail(const uq_t *q)
+{
+    if (list_empty(&q->chunks))
+        return NULL;
+    const uq_chunk_t *c = list_last_entry(&q->chunks, uq_chunk_t, list);
+    return c->slot[c->start + c->count - 1];
+}
+
+/**
+ * uq_size() - Number of elements in the unrolled queue
+ * @q: unrolled queue
+ *
+ * Adds up the counts of the chunks, without touching the elements.
+ *
+ * Return: the number of elements, 0 if @q is NULL or empty.
+ */
+int uq_size(const uq_t *q);
+
+/**
+ * uq_reverse() - Reverse elements in the unrolled queue
+ * @q: unrolled queue
+ *
+ * Reverses the order of the chunks and of the pointers within each chunk.
+ * Nothing is allocated and the elements are not touched.
+ */
+void uq_reverse(uq_t *q);
+
+/**
+ * uq_to_list() - Move all elements of @q to the list queue @head, in order
+ * @q: unrolled queue, left empty
+ * @head: header of an empty list queue
+ *
+ * The chunks are kept as spares for uq_from_list(), so that packing the
+ * elements of all queues back after an operation that removes or only
+ * moves elements never allocates.
+ */
+void uq_to_list(uq_t *q, struct list_head *head);
+
+/**
+ * uq_from_list() - Move all elements of the list queue @head to the tail of
+ *                  @q, filling whole chunks
+ * @q: unrolled queue
+ * @head: header of list queue
+ *
+ * Spare chunks left by uq_to_list() are used first.
+ *
+ * Return: true for success, false if a chunk could not be allocated, in
+ * which case the elements not moved stay on @head.
+ */
+bool uq_from_list(uq_t *q, struct list_head *head);
+
+/**
+ * uq_release_spares() - Free the spare chunks left by uq_to_list()
+ */
+void uq_release_spares();
+
+#endif /* LAB0_UNROLLED_H */
@@ -4,16 +4,37 @@
 
 #include <arpa/inet.h> /* inet_ntoa */
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h> /* strncasecmp */
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-#define LISTENQ 1024 /* second argument to listen() */
-#define MAXLINE 1024 /* max length of a line */
-#define BUFSIZE 1024
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+#include <sys/event.h>
+#else
+#error Unsupported platform
+#endif
+
+#include "web.h"
+
+#define LISTENQ 1024  /* second argument to listen() */
+#define MAXLINE 1024  /* max length of a line */
+#define BUFSIZE 8192  /* room for a few pipelined requests */
+#define MAXEVENTS 64  /* events taken from the kernel at a time */
+
+/* Requests for paths under this prefix download files from the working
+ * directory instead of running a command
+ */
+#define FILE_PREFIX "file/"
 
 #ifndef DEFAULT_PORT
 #define DEFAULT_PORT 9999 /* use this port if none given as arg to main() */
@@ -34,8 +55,34 @@ typedef struct {
     char filename[512];
     off_t offset; /* for support Range */
     size_t end;
+    bool range;      /* the client asked for part of the file */
+    bool keep_alive; /* leave the connection open after the response */
+    bool chunked;    /* the client takes chunked responses (HTTP/1.1) */
 } http_request_t;
 
+/* A client connection served by the event loop */
+typedef struct web_conn {
+    int fd;
+    rio_t rio;      /* requests received but not parsed yet */
+    char *out;      /* responses not written to the socket yet */
+    size_t out_len; /* bytes in out */
+    size_t out_cap; /* size of out */
+    size_t out_off; /* bytes of out already written */
+    bool closing;   /* close once out is written */
+    bool eof;       /* no more requests will arrive */
+    bool chunked;   /* send the current response with chunked encoding */
+    int file_fd;    /* file being sent after out, or -1 */
+    off_t file_off; /* next byte of the file to send */
+    off_t file_end; /* end of the part of the file to send */
+    struct web_conn *next_closed;
+} web_conn_t;
+
+static int listenfd = -1;
+static int event_fd = -1;
+
+/* Connection whose request is being run, whose output web_send() buffers */
+static web_conn_t *current_conn = NULL;
+
 static void rio_readinitb(rio_t *rp, int fd)
 {
     rp->fd = fd;
@@ -116,14 +163,150 @@ static ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
     return n;
 }
 
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Watch @fd for input, and for output too if @want_write */
+static int ev_watch(int fd, void *data, bool add, bool want_write)
+{
+#if defined(__linux__)
+    struct epoll_event ev = {
+        .events = EPOLLIN | (want_write ? EPOLLOUT : 0),
+        .data.ptr = data,
+    };
+    return epoll_ctl(event_fd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+#else
+    struct kevent ev[2];
+    EV_SET(&ev[0], fd, EVFILT_READ, EV_ADD, 0, 0, data);
+    EV_SET(&ev[1], fd, EVFILT_WRITE, want_write ? EV_ADD : EV_DELETE, 0, 0,
+           data);
+    /* deleting a write filter that was never added fails harmlessly */
+    kevent(event_fd, ev, 2, NULL, 0, NULL);
+    (void) add;
+    return 0;
+#endif
+}
+
+static bool conn_append(web_conn_t *conn, const char *buf, size_t len)
+{
+    if (conn->out_len + len > conn->out_cap) {
+        size_t cap = conn->out_cap ? conn->out_cap : BUFSIZE;
+        while (cap < conn->out_len + len)
+            cap *= 2;
+        char *out = realloc(conn->out, cap);
+        if (!out)
+            return false;
+        conn->out = out;
+        conn->out_cap = cap;
+    }
+    memcpy(conn->out + conn->out_len, buf, len);
+    conn->out_len += len;
+    return true;
+}
+
+/* Send the file of @conn straight from the page cache, without copying it
+ * through user space, as far as the socket takes it without blocking.
+ * Return false if the connection failed.
+ */
+static bool conn_push_file(web_conn_t *conn)
+{
+    while (conn->file_fd >= 0 && conn->file_off < conn->file_end) {
+#if defined(__linux__)
+        ssize_t n = sendfile(conn->fd, conn->file_fd, &conn->file_off,
+                             conn->file_end - conn->file_off);
+#else
+        char buf[BUFSIZE];
+        size_t len = conn->file_end - conn->file_off;
+        if (len > sizeof(buf))
+            len = sizeof(buf);
+        ssize_t n = pread(conn->file_fd, buf, len, conn->file_off);
+        if (n > 0) {
+            n = write(conn->fd, buf, n);
+            if (n > 0)
+                conn->file_off += n;
+        }
+#endif
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        /* the file was truncated under us, so the response cannot complete */
+        if (n == 0)
+            return false;
+    }
+    if (conn->file_fd >= 0) {
+        close(conn->file_fd);
+        conn->file_fd = -1;
+    }
+    return true;
+}
+
+/* Write as much of the queued output of @conn as the socket takes without
+ * blocking.  Return false if the connection failed.
+ */
+static bool conn_push(web_conn_t *conn)
+{
+    while (conn->out_off < conn->out_len) {
+        ssize_t n = write(conn->fd, conn->out + conn->out_off,
+                          conn->out_len - conn->out_off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return false;
+            /* keep the unwritten part at the front of the buffer */
+            conn->out_len -= conn->out_off;
+            memmove(conn->out, conn->out + conn->out_off, conn->out_len);
+            conn->out_off = 0;
+            return true;
+        }
+        conn->out_off += n;
+    }
+    conn->out_off = conn->out_len = 0;
+    return conn_push_file(conn);
+}
+
+/* Queue @len bytes of response body, as one chunk if the response is chunked.
+ * Output is written out in pieces of BUFSIZE bytes while the command runs, and
+ * the rest once the requests at hand have all been answered.
+ */
+static void conn_send(web_conn_t *conn, const char *buf, size_t len)
+{
+    char size[32];
+    bool ok;
+
+    /* an empty chunk would end the response */
+    if (!len || conn->closing)
+        return;
+    if (conn->chunked) {
+        int n = snprintf(size, sizeof(size), "%zx\r\n", len);
+        ok = conn_append(conn, size, n) && conn_append(conn, buf, len) &&
+             conn_append(conn, "\r\n", 2);
+    } else {
+        ok = conn_append(conn, buf, len);
+    }
+    if (ok && conn->out_len - conn->out_off >= BUFSIZE)
+        ok = conn_push(conn);
+    if (!ok)
+        conn->closing = true;
+}
+
 void web_send(int out_fd, char *buf)
 {
+    if (current_conn && current_conn->fd == out_fd) {
+        conn_send(current_conn, buf, strlen(buf));
+        return;
+    }
     writen(out_fd, buf, strlen(buf));
 }
 
 int web_open(int port)
 {
-    int listenfd, optval = 1;
+    int optval = 1;
     struct sockaddr_in serveraddr;
 
     /* Create a socket descriptor */
@@ -151,7 +334,16 @@ int web_open(int port)
         return -1;
 
     /* Make it a listening socket ready to accept connection requests */
-    if (listen(listenfd, LISTENQ) < 0)
+    if (listen(listenfd, LISTENQ) < 0 || set_nonblocking(listenfd) < 0)
+        return -1;
+
+#if defined(__linux__)
+    event_fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+    event_fd = kqueue();
+#endif
+    /* The listening socket is the one without a connection */
+    if (event_fd < 0 || ev_watch(listenfd, NULL, true, false) < 0)
         return -1;
     return listenfd;
 }
@@ -172,27 +364,44 @@ static void url_decode(char *src, char *dest, int max)
     *dest = '\0';
 }
 
-static void parse_request(int fd, http_request_t *req)
+/* Parse one request out of @rio, which must hold the whole header block */
+static void parse_request(rio_t *rio, http_request_t *req)
 {
-    rio_t rio;
-    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE];
+    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
     req->offset = 0;
     req->end = 0; /* default */
+    req->range = false;
 
-    rio_readinitb(&rio, fd);
-    rio_readlineb(&rio, buf, MAXLINE);
-    sscanf(buf, "%1023s %1023s", method, uri); /* version is not cared */
+    if (rio_readlineb(rio, buf, MAXLINE) <= 0)
+        buf[0] = '\0';
+    method[0] = uri[0] = version[0] = '\0';
+    sscanf(buf, "%1023s %1023s %1023s", method, uri, version);
+    /* HTTP/1.1 keeps the connection by default, HTTP/1.0 closes it */
+    req->chunked = req->keep_alive = !strcmp(version, "HTTP/1.1");
     /* read all */
-    while (buf[0] != '\n' && buf[1] != '\n') { /* \n || \r\n */
-        rio_readlineb(&rio, buf, MAXLINE);
+    while (buf[0] && buf[0] != '\n' && buf[1] != '\n') { /* \n || \r\n */
+        if (rio_readlineb(rio, buf, MAXLINE) <= 0)
+            break;
         if (buf[0] == 'R' && buf[1] == 'a' && buf[2] == 'n') {
-            sscanf(buf, "Range: bytes=%lu-%lu", (unsigned long *) &req->offset,
-                   (unsigned long *) &req->end);
+            req->range = sscanf(buf, "Range: bytes=%lu-%lu",
+                                (unsigned long *) &req->offset,
+                                (unsigned long *) &req->end) > 0;
             /* Range: [start, end] */
             if (req->end != 0)
                 req->end++;
+        } else if (!strncasecmp(buf, "Connection:", 11)) {
+            char *value = buf + 11;
+            while (*value == ' ')
+                value++;
+            if (!strncasecmp(value, "close", 5))
+                req->keep_alive = false;
+            else if (!strncasecmp(value, "keep-alive", 10))
+                req->keep_alive = true;
         }
     }
+    /* Without chunked encoding, closing is what ends the response */
+    if (!req->chunked)
+        req->keep_alive = false;
     char *filename = uri;
     if (uri[0] == '/') {
         filename = uri + 1;
@@ -211,20 +420,346 @@ static void parse_request(int fd, http_request_t *req)
     url_decode(filename, req->filename, MAXLINE);
 }
 
-char *web_recv(int fd, struct sockaddr_in *clientaddr)
+/* Turn the path of @req into a command line, allocated with malloc() */
+static char *request_cmd(http_request_t *req)
 {
-    http_request_t req;
-    parse_request(fd, &req);
-
-    char *p = req.filename;
+    char *p = req->filename;
     /* Change '/' to ' ' */
     while (*p) {
         ++p;
         if (*p == '/')
             *p = ' ';
     }
-    char *ret = malloc(strlen(req.filename) + 1);
-    strncpy(ret, req.filename, strlen(req.filename) + 1);
+    char *ret = malloc(strlen(req->filename) + 1);
+    if (ret)
+        strncpy(ret, req->filename, strlen(req->filename) + 1);
 
     return ret;
 }
+
+char *web_recv(int fd, struct sockaddr_in *clientaddr)
+{
+    rio_t rio;
+    http_request_t req;
+
+    rio_readinitb(&rio, fd);
+    parse_request(&rio, &req);
+    return request_cmd(&req);
+}
+
+/* Event loop
+ *
+ * Every connection is non-blocking and watched for input.  Bytes read are
+ * appended to the rio_t buffer of the connection, and each complete header
+ * block found there is parsed and run in turn, so a client may pipeline
+ * requests.  Responses are written as the commands produce them, in the
+ * order of the requests.  What the socket does not take right away is
+ * queued on the connection, and only while some is left is the connection
+ * watched for output too.  Requests for FILE_PREFIX paths are answered with
+ * sendfile() instead, and hold back the requests after them until the file
+ * has been sent.
+ */
+
+/* Connections closed while handling the current batch of events, which
+ * may still refer to them
+ */
+static web_conn_t *closed_conns = NULL;
+
+static void conn_close(web_conn_t *conn)
+{
+    /* closing the descriptor also drops it from the event set */
+    close(conn->fd);
+    conn->fd = -1;
+    if (conn->file_fd >= 0)
+        close(conn->file_fd);
+    conn->file_fd = -1;
+    conn->next_closed = closed_conns;
+    closed_conns = conn;
+}
+
+/* Write out as much of the queued responses as the socket takes.
+ * Return false once the connection is gone.
+ */
+static bool conn_flush(web_conn_t *conn)
+{
+    if (!conn_push(conn)) {
+        conn_close(conn);
+        return false;
+    }
+    if (conn->out_off < conn->out_len || conn->file_fd >= 0) {
+        ev_watch(conn->fd, conn, false, true);
+        return true;
+    }
+    if (conn->closing) {
+        conn_close(conn);
+        return false;
+    }
+    ev_watch(conn->fd, conn, false, false);
+    return true;
+}
+
+/* Find the end of a complete header block in the buffer of @rio */
+static bool rio_has_request(rio_t *rp)
+{
+    for (int i = 1; i < rp->count; i++) {
+        if (rp->bufptr[i] != '\n')
+            continue;
+        if (rp->bufptr[i - 1] == '\n' ||
+            (i > 1 && rp->bufptr[i - 1] == '\r' && rp->bufptr[i - 2] == '\n'))
+            return true;
+    }
+    return false;
+}
+
+/* Read whatever has arrived on @conn into its rio_t buffer.
+ * Return false on end of file or error.
+ */
+static bool conn_fill(web_conn_t *conn)
+{
+    rio_t *rp = &conn->rio;
+
+    /* move the unparsed bytes to the front to make room */
+    if (rp->bufptr != rp->buf) {
+        memmove(rp->buf, rp->bufptr, rp->count);
+        rp->bufptr = rp->buf;
+    }
+    while (rp->count < (int) sizeof(rp->buf)) {
+        ssize_t n = read(conn->fd, rp->buf + rp->count,
+                         sizeof(rp->buf) - rp->count);
+        if (n > 0) {
+            rp->count += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    return true;
+}
+
+/* Run the command of @req, streaming its output to @conn as the response */
+static void conn_respond(web_conn_t *conn, http_request_t *req,
+                         web_cmd_func_t cmd_func)
+{
+    static const char chunked_header[] =
+        "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n";
+    static const char close_header[] =
+        "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+        "Connection: close\r\n\r\n";
+
+    conn->chunked = false;
+    if (req->chunked && req->keep_alive)
+        conn_send(conn, chunked_header, sizeof(chunked_header) - 1);
+    else
+        conn_send(conn, close_header, sizeof(close_header) - 1);
+    conn->chunked = req->chunked && req->keep_alive;
+
+    char *cmd = request_cmd(req);
+    if (cmd) {
+        current_conn = conn;
+        cmd_func(conn->fd, cmd);
+        current_conn = NULL;
+        free(cmd);
+    }
+
+    if (conn->chunked) {
+        /* the last chunk is empty */
+        if (!conn_append(conn, "0\r\n\r\n", 5))
+            conn->closing = true;
+    } else {
+        conn->closing = true;
+    }
+}
+
+/* Answer @req with the file it names, or the part of it given by its Range
+ * header.  The headers are queued, and the body follows them through
+ * conn_push_file() once they are written.
+ */
+static void conn_respond_file(web_conn_t *conn, http_request_t *req)
+{
+    const char *path = req->filename + strlen(FILE_PREFIX);
+    const char *connection = req->keep_alive ? "" : "Connection: close\r\n";
+    char header[MAXLINE];
+    struct stat st;
+    int fd = -1, n;
+
+    /* only serve what lies under the working directory */
+    bool safe = path[0] && path[0] != '/';
+    for (const char *p = path; safe && (p = strstr(p, "..")); p += 2) {
+        if ((p == path || p[-1] == '/') && (p[2] == '/' || !p[2]))
+            safe = false;
+    }
+    if (safe)
+        fd = open(path, O_RDONLY);
+    if (fd >= 0 && (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n%s\r\n",
+                     connection);
+        if (!conn_append(conn, header, n))
+            conn->closing = true;
+        conn->closing |= !req->keep_alive;
+        return;
+    }
+
+    off_t size = st.st_size;
+    off_t start = req->range ? req->offset : 0;
+    off_t end = req->range && req->end ? (off_t) req->end : size;
+    if (end > size)
+        end = size;
+    if (req->range && start >= end) {
+        close(fd);
+        n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                     "Content-Range: bytes */%lld\r\n"
+                     "Content-Length: 0\r\n%s\r\n",
+                     (long long) size, connection);
+        if (!conn_append(conn, header, n))
+            conn->closing = true;
+        conn->closing |= !req->keep_alive;
+        return;
+    }
+
+    if (req->range) {
+        n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 206 Partial Content\r\n"
+                     "Content-Type: application/octet-stream\r\n"
+                     "Content-Range: bytes %lld-%lld/%lld\r\n"
+                     "Content-Length: %lld\r\n%s\r\n",
+                     (long long) start, (long long) end - 1, (long long) size,
+                     (long long) (end - start), connection);
+    } else {
+        n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: application/octet-stream\r\n"
+                     "Content-Length: %lld\r\n%s\r\n",
+                     (long long) size, connection);
+    }
+    if (!conn_append(conn, header, n)) {
+        close(fd);
+        conn->closing = true;
+        return;
+    }
+    conn->file_fd = fd;
+    conn->file_off = start;
+    conn->file_end = end;
+    conn->closing |= !req->keep_alive;
+}
+
+/* Answer the complete requests buffered on @conn, in order, and write out
+ * what the socket takes.  A file being sent holds back the requests after it.
+ */
+static void conn_serve(web_conn_t *conn, web_cmd_func_t cmd_func)
+{
+    for (;;) {
+        /* start sending a file right away, so small ones need no extra event */
+        if (conn->file_fd >= 0 && !conn_flush(conn))
+            return;
+        if (conn->closing || conn->file_fd >= 0 ||
+            !rio_has_request(&conn->rio))
+            break;
+        http_request_t req;
+        parse_request(&conn->rio, &req);
+        if (!strncmp(req.filename, FILE_PREFIX, strlen(FILE_PREFIX)))
+            conn_respond_file(conn, &req);
+        else
+            conn_respond(conn, &req, cmd_func);
+    }
+    if (conn->eof && conn->file_fd < 0)
+        conn->closing = true;
+    conn_flush(conn);
+}
+
+static void conn_readable(web_conn_t *conn, web_cmd_func_t cmd_func)
+{
+    bool open = conn_fill(conn);
+
+    /* a request that does not fit in the buffer can never complete */
+    if (!open || (conn->rio.count == (int) sizeof(conn->rio.buf) &&
+                  !rio_has_request(&conn->rio)))
+        conn->eof = true;
+    conn_serve(conn, cmd_func);
+}
+
+static void web_accept(void)
+{
+    for (;;) {
+        struct sockaddr_in clientaddr;
+        socklen_t clientlen = sizeof(clientaddr);
+        int fd = accept(listenfd, (struct sockaddr *) &clientaddr, &clientlen);
+        if (fd < 0)
+            return;
+
+        int optval = 1;
+        web_conn_t *conn = calloc(1, sizeof(web_conn_t));
+        if (!conn || set_nonblocking(fd) < 0) {
+            free(conn);
+            close(fd);
+            continue;
+        }
+        /* Responses are written whole, so send them right away instead of
+         * leaving them corked on an idle connection.
+         */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const void *) &optval,
+                   sizeof(int));
+        optval = 0;
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, (const void *) &optval,
+                   sizeof(int));
+
+        conn->fd = fd;
+        conn->file_fd = -1;
+        rio_readinitb(&conn->rio, fd);
+        if (ev_watch(fd, conn, true, false) < 0)
+            conn_close(conn);
+    }
+}
+
+int web_eventfd(void)
+{
+    return event_fd;
+}
+
+void web_dispatch(web_cmd_func_t cmd_func)
+{
+    int n;
+#if defined(__linux__)
+    struct epoll_event events[MAXEVENTS];
+    n = epoll_wait(event_fd, events, MAXEVENTS, 0);
+#else
+    struct kevent events[MAXEVENTS];
+    struct timespec zero = {0, 0};
+    n = kevent(event_fd, NULL, 0, events, MAXEVENTS, &zero);
+#endif
+
+    for (int i = 0; i < n; i++) {
+#if defined(__linux__)
+        web_conn_t *conn = events[i].data.ptr;
+        bool readable = events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR);
+        bool writable = events[i].events & EPOLLOUT;
+#else
+        web_conn_t *conn = events[i].udata;
+        bool readable = events[i].filter == EVFILT_READ;
+        bool writable = events[i].filter == EVFILT_WRITE;
+#endif
+        if (!conn) {
+            web_accept();
+        } else if (conn->fd < 0) {
+            continue;
+        } else if (readable) {
+            conn_readable(conn, cmd_func);
+        } else if (writable) {
+            conn_serve(conn, cmd_func);
+        }
+    }
+
+    while (closed_conns) {
+        web_conn_t *conn = closed_conns;
+        closed_conns = conn->next_closed;
+        free(conn->out);
+        free(conn);
+    }
+}
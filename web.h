@@ -2,9 +2,24 @@
 #define TINYWEB_H
 
 #include <netinet/in.h>
+#include <stdbool.h>
 
+/* Runs one command line received on connection @fd */
+typedef bool (*web_cmd_func_t)(int fd, char *cmdline);
+
+/* Listen on @port and set up the event loop serving the connections.
+ * Return the listening socket, or -1 on failure.
+ */
 int web_open(int port);
 
+/* Descriptor that becomes readable when web_dispatch() has work to do */
+int web_eventfd(void);
+
+/* Serve whatever is ready without blocking.  Each request runs @cmd_func,
+ * and what it passes to web_send() for the connection is its response.
+ */
+void web_dispatch(web_cmd_func_t cmd_func);
+
 char *web_recv(int fd, struct sockaddr_in *clientaddr);
 
 void web_send(int out_fd, char *buffer);